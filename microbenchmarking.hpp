@@ -138,31 +138,31 @@ protected:
     int fd_hw_cache1_ = -1;
 
     //! first cache measurement level
-    PerfCache hw_cache1_;
+    PerfCache hw_cache1_ = PerfCache::L1D;
     //! first cache measurement operation
-    PerfCacheOp hw_cache1_op_;
+    PerfCacheOp hw_cache1_op_ = PerfCacheOp::Read;
     //! first cache measurement operation result
-    PerfCacheOpResult hw_cache1_op_result_;
+    PerfCacheOpResult hw_cache1_op_result_ = PerfCacheOpResult::Access;
 
     //! file descriptor for second cache measurement
     int fd_hw_cache2_ = -1;
 
     //! second cache measurement level
-    PerfCache hw_cache2_;
+    PerfCache hw_cache2_ = PerfCache::L1D;
     //! second cache measurement operation
-    PerfCacheOp hw_cache2_op_;
+    PerfCacheOp hw_cache2_op_ = PerfCacheOp::Read;
     //! second cache measurement operation result
-    PerfCacheOpResult hw_cache2_op_result_;
+    PerfCacheOpResult hw_cache2_op_result_ = PerfCacheOpResult::Access;
 
     //! file descriptor for third cache measurement
     int fd_hw_cache3_ = -1;
 
     //! third cache measurement level
-    PerfCache hw_cache3_;
+    PerfCache hw_cache3_ = PerfCache::L1D;
     //! third cache measurement operation
-    PerfCacheOp hw_cache3_op_;
+    PerfCacheOp hw_cache3_op_ = PerfCacheOp::Read;
     //! third cache measurement operation result
-    PerfCacheOpResult hw_cache3_op_result_;
+    PerfCacheOpResult hw_cache3_op_result_ = PerfCacheOpResult::Access;
 
     //! file descriptor for first custom measurement
     int fd_custom1_ = -1;
@@ -0,0 +1,112 @@
+/*******************************************************************************
+ * sort/extra/american_flag_sort.hpp
+ *
+ * Sequential in-place most-significant-digit radix sort (American flag sort)
+ * with 8-bit digits. Items are permuted into their buckets by following swap
+ * cycles, small buckets are finished by insertion sort.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_EXTRA_AMERICAN_FLAG_SORT_HEADER
+#define MBM_SORT_EXTRA_AMERICAN_FLAG_SORT_HEADER
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace american_flag_sort {
+
+//! buckets up to this size are sorted by insertion sort
+static const size_t insertion_sort_threshold = 32;
+
+template <typename Iterator, typename KeyGetter>
+void insertion_sort(Iterator begin, Iterator end, KeyGetter key) {
+    if (begin == end)
+        return;
+    for (Iterator i = begin + 1; i != end; ++i) {
+        if (!(key(*i) < key(*(i - 1))))
+            continue;
+        auto tmp = std::move(*i);
+        Iterator j = i;
+        do {
+            *j = std::move(*(j - 1));
+            --j;
+        } while (j != begin && key(tmp) < key(*(j - 1)));
+        *j = std::move(tmp);
+    }
+}
+
+/*!
+ * Sort [begin,end) by the unsigned key(item), of which the first depth bytes
+ * (from the most significant) are equal for all items.
+ */
+template <typename Iterator, typename KeyGetter>
+void sort(Iterator begin, Iterator end, KeyGetter key, size_t depth = 0) {
+    using Key = typename std::decay<decltype(key(*begin))>::type;
+    static_assert(std::is_unsigned<Key>::value, "Key must be unsigned");
+
+    const size_t n = end - begin;
+
+    // skip digits on which all items agree, without recursion
+    while (true) {
+        if (n <= insertion_sort_threshold)
+            return american_flag_sort::insertion_sort(begin, end, key);
+
+        const size_t shift = 8 * (sizeof(Key) - 1 - depth);
+        auto digit = [&](const auto& x) {
+            return static_cast<size_t>((key(x) >> shift) & 0xFF);
+        };
+
+        size_t count[256] = {};
+        for (Iterator it = begin; it != end; ++it)
+            ++count[digit(*it)];
+
+        if (count[digit(*begin)] == n) {
+            if (++depth == sizeof(Key))
+                return;
+            continue;
+        }
+
+        size_t head[256], tail[256], sum = 0;
+        for (size_t b = 0; b < 256; ++b) {
+            head[b] = sum;
+            sum += count[b];
+            tail[b] = sum;
+        }
+
+        // permute cycles: carry the displaced item to its bucket's next slot
+        for (size_t b = 0; b < 256; ++b) {
+            while (head[b] < tail[b]) {
+                auto v = std::move(begin[head[b]]);
+                size_t d = digit(v);
+                while (d != b) {
+                    std::swap(v, begin[head[d]++]);
+                    d = digit(v);
+                }
+                begin[head[b]++] = std::move(v);
+            }
+        }
+
+        if (depth + 1 == sizeof(Key))
+            return;
+
+        Iterator bucket = begin;
+        for (size_t b = 0; b < 256; ++b) {
+            if (count[b] > 1) {
+                american_flag_sort::sort(
+                    bucket, bucket + count[b], key, depth + 1);
+            }
+            bucket += count[b];
+        }
+        return;
+    }
+}
+
+} // namespace american_flag_sort
+
+#endif // !MBM_SORT_EXTRA_AMERICAN_FLAG_SORT_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,223 @@
+/*******************************************************************************
+ * sort/extra/block_quicksort.hpp
+ *
+ * Introsort with the branchless block partitioning of BlockQuicksort by
+ * Edelkamp and Weiß: comparison results are first stored as offsets in two
+ * small buffers, then the misplaced elements are swapped in a second loop,
+ * hence the comparisons cause no branch mispredictions.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_EXTRA_BLOCK_QUICKSORT_HEADER
+#define MBM_SORT_EXTRA_BLOCK_QUICKSORT_HEADER
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <utility>
+
+namespace block_quicksort {
+
+//! number of elements scanned into an offset buffer
+static const size_t block_size = 128;
+
+//! ranges up to this size are sorted by insertion sort
+static const size_t insertion_sort_threshold = 24;
+
+//! ranges from this size on use the pseudo-median of nine as pivot
+static const size_t ninther_threshold = 128;
+
+template <typename Iterator, typename Compare>
+void insertion_sort(Iterator begin, Iterator end, Compare cmp) {
+    if (begin == end)
+        return;
+    for (Iterator i = begin + 1; i != end; ++i) {
+        if (!cmp(*i, *(i - 1)))
+            continue;
+        auto tmp = std::move(*i);
+        Iterator j = i;
+        do {
+            *j = std::move(*(j - 1));
+            --j;
+        } while (j != begin && cmp(tmp, *(j - 1)));
+        *j = std::move(tmp);
+    }
+}
+
+//! sort a, b, c such that the median ends up in b
+template <typename Iterator, typename Compare>
+void sort3(Iterator a, Iterator b, Iterator c, Compare cmp) {
+    if (cmp(*b, *a))
+        std::iter_swap(a, b);
+    if (cmp(*c, *b))
+        std::iter_swap(b, c);
+    if (cmp(*b, *a))
+        std::iter_swap(a, b);
+}
+
+//! move the median of three or the pseudo-median of nine to *begin
+template <typename Iterator, typename Compare>
+void select_pivot(Iterator begin, Iterator end, Compare cmp) {
+    size_t n = end - begin, half = n / 2;
+    if (n >= ninther_threshold) {
+        sort3(begin, begin + half, end - 1, cmp);
+        sort3(begin + 1, begin + (half - 1), end - 2, cmp);
+        sort3(begin + 2, begin + (half + 1), end - 3, cmp);
+        sort3(begin + (half - 1), begin + half, begin + (half + 1), cmp);
+        std::iter_swap(begin, begin + half);
+    }
+    else {
+        sort3(begin + half, begin, end - 1, cmp);
+    }
+}
+
+/*!
+ * Partition [begin,end) around the pivot *begin into elements less than the
+ * pivot and elements not less than it, return the final pivot position.
+ * [first,last) is the unpartitioned range, offsets_l holds positions of
+ * misplaced elements in the left block, offsets_r (one-based, from last) those
+ * in the right block.
+ */
+template <typename Iterator, typename Compare>
+Iterator block_partition(Iterator begin, Iterator end, Compare cmp) {
+    auto pivot = std::move(*begin);
+    Iterator first = begin + 1, last = end;
+
+    unsigned char offsets_l[block_size], offsets_r[block_size];
+    size_t num_l = 0, num_r = 0, start_l = 0, start_r = 0;
+
+    //! scan size elements from first into offsets_l
+    auto scan_left = [&](size_t size) {
+        start_l = 0;
+        Iterator it = first;
+        for (size_t i = 0; i < size; ++i, ++it) {
+            offsets_l[num_l] = static_cast<unsigned char>(i);
+            num_l += !cmp(*it, pivot);
+        }
+    };
+    //! scan size elements before last into offsets_r
+    auto scan_right = [&](size_t size) {
+        start_r = 0;
+        Iterator it = last;
+        for (size_t i = 0; i < size;) {
+            offsets_r[num_r] = static_cast<unsigned char>(++i);
+            num_r += cmp(*--it, pivot);
+        }
+    };
+    //! swap as many misplaced pairs as both buffers hold
+    auto swap_offsets = [&]() {
+        size_t num = std::min(num_l, num_r);
+        for (size_t i = 0; i < num; ++i) {
+            std::iter_swap(first + offsets_l[start_l + i],
+                last - offsets_r[start_r + i]);
+        }
+        num_l -= num, num_r -= num;
+        start_l += num, start_r += num;
+    };
+
+    while (static_cast<size_t>(last - first) > 2 * block_size) {
+        if (num_l == 0)
+            scan_left(block_size);
+        if (num_r == 0)
+            scan_right(block_size);
+        swap_offsets();
+        if (num_l == 0)
+            first += block_size;
+        if (num_r == 0)
+            last -= block_size;
+    }
+
+    // scan the rest, at most one of the blocks is still pending
+    size_t l_size, r_size;
+    size_t unknown = (last - first) - ((num_l || num_r) ? block_size : 0);
+    if (num_r) {
+        l_size = unknown, r_size = block_size;
+    }
+    else if (num_l) {
+        l_size = block_size, r_size = unknown;
+    }
+    else {
+        l_size = unknown / 2, r_size = unknown - l_size;
+    }
+    if (unknown && num_l == 0)
+        scan_left(l_size);
+    if (unknown && num_r == 0)
+        scan_right(r_size);
+    swap_offsets();
+    if (num_l == 0)
+        first += l_size;
+    if (num_r == 0)
+        last -= r_size;
+
+    // move the remaining misplaced elements of one side to the middle
+    if (num_l) {
+        while (num_l--)
+            std::iter_swap(first + offsets_l[start_l + num_l], --last);
+        first = last;
+    }
+    if (num_r) {
+        while (num_r--)
+            std::iter_swap(last - offsets_r[start_r + num_r], first), ++first;
+        last = first;
+    }
+
+    Iterator pivot_pos = first - 1;
+    *begin = std::move(*pivot_pos);
+    *pivot_pos = std::move(pivot);
+    return pivot_pos;
+}
+
+template <typename Iterator, typename Compare>
+void introsort_loop(Iterator begin, Iterator end, Compare cmp,
+    size_t depth_limit, bool leftmost) {
+    while (static_cast<size_t>(end - begin) > insertion_sort_threshold) {
+        if (depth_limit == 0) {
+            std::make_heap(begin, end, cmp);
+            std::sort_heap(begin, end, cmp);
+            return;
+        }
+        --depth_limit;
+
+        select_pivot(begin, end, cmp);
+
+        // if the pivot equals the element before the range, which is a lower
+        // bound of it, then skip all elements equal to the pivot. This keeps
+        // inputs with many duplicates at O(n log d).
+        if (!leftmost && !cmp(*(begin - 1), *begin)) {
+            const auto& pivot = *begin;
+            begin = std::partition(begin + 1, end,
+                [&](const auto& x) { return !cmp(pivot, x); });
+            continue;
+        }
+
+        Iterator mid = block_partition(begin, end, cmp);
+
+        // recurse into the smaller part, loop on the larger one
+        if (mid - begin < end - mid) {
+            introsort_loop(begin, mid, cmp, depth_limit, leftmost);
+            begin = mid + 1, leftmost = false;
+        }
+        else {
+            introsort_loop(mid + 1, end, cmp, depth_limit, false);
+            end = mid;
+        }
+    }
+    block_quicksort::insertion_sort(begin, end, cmp);
+}
+
+template <typename Iterator, typename Compare>
+void sort(Iterator begin, Iterator end, Compare cmp) {
+    size_t n = end - begin, depth_limit = 0;
+    while (n > 1)
+        n /= 2, depth_limit += 2;
+    introsort_loop(begin, end, cmp, depth_limit, /* leftmost */ true);
+}
+
+} // namespace block_quicksort
+
+#endif // !MBM_SORT_EXTRA_BLOCK_QUICKSORT_HEADER
+
+/******************************************************************************/
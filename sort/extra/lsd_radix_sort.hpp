@@ -0,0 +1,79 @@
+/*******************************************************************************
+ * sort/extra/lsd_radix_sort.hpp
+ *
+ * Sequential least-significant-digit radix sort with 8-bit digits. The
+ * histograms of all digits are counted in one fused pass over the input, and
+ * passes in which all items fall into one bucket are skipped.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_EXTRA_LSD_RADIX_SORT_HEADER
+#define MBM_SORT_EXTRA_LSD_RADIX_SORT_HEADER
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace lsd_radix_sort {
+
+/*!
+ * Sort [begin,end) by the unsigned key(item), using [buffer,buffer+n) as
+ * scatter target. The buffer may be uninitialized for trivially copyable
+ * items. Returns the number of scatter passes executed.
+ */
+template <typename Iterator, typename KeyGetter>
+size_t sort(Iterator begin, Iterator end, Iterator buffer, KeyGetter key) {
+    using Key = typename std::decay<decltype(key(*begin))>::type;
+    static_assert(std::is_unsigned<Key>::value, "Key must be unsigned");
+    static const size_t digits = sizeof(Key);
+
+    const size_t n = end - begin;
+    if (n <= 1)
+        return 0;
+
+    // fused histograms of all digits
+    size_t hist[digits][256] = {};
+    for (Iterator it = begin; it != end; ++it) {
+        Key k = key(*it);
+        for (size_t d = 0; d < digits; ++d)
+            ++hist[d][(k >> (8 * d)) & 0xFF];
+    }
+
+    Iterator from = begin, to = buffer;
+    size_t passes = 0;
+    const Key first_key = key(*begin);
+
+    for (size_t d = 0; d < digits; ++d) {
+        // all items have the same digit, the pass would be the identity
+        if (hist[d][(first_key >> (8 * d)) & 0xFF] == n)
+            continue;
+
+        size_t offset[256], sum = 0;
+        for (size_t b = 0; b < 256; ++b) {
+            offset[b] = sum;
+            sum += hist[d][b];
+        }
+
+        for (Iterator it = from; it != from + n; ++it)
+            to[offset[(key(*it) >> (8 * d)) & 0xFF]++] = std::move(*it);
+
+        std::swap(from, to);
+        ++passes;
+    }
+
+    if (from != begin)
+        std::move(from, from + n, begin);
+
+    return passes;
+}
+
+} // namespace lsd_radix_sort
+
+#endif // !MBM_SORT_EXTRA_LSD_RADIX_SORT_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,387 @@
+/*******************************************************************************
+ * sort/extra/merge.hpp
+ *
+ * Merging of sorted runs: a branchless two-way merge, a two-way merge of
+ * word-sized items by an AVX2 bitonic merge network, a cascade of two-way
+ * merges for k runs, and k-way merges with a binary heap and with tlx's
+ * guarded and sentinel (unguarded) loser trees.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_EXTRA_MERGE_HEADER
+#define MBM_SORT_EXTRA_MERGE_HEADER
+
+#include "simd_small_sort.hpp"
+
+#include <tlx/container/loser_tree.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace merging {
+
+/******************************************************************************/
+// Two-Way Merges
+
+/*!
+ * Merge [a,a_end) and [b,b_end) into out. The smaller head is selected by a
+ * conditional move of the source iterator and both inputs are advanced
+ * arithmetically, such that only the loop condition branches.
+ */
+template <typename Iterator, typename OutIterator, typename Compare>
+OutIterator branchless_merge(Iterator a, Iterator a_end, Iterator b,
+    Iterator b_end, OutIterator out, Compare cmp) {
+    while (a != a_end && b != b_end) {
+        bool take_b = cmp(*b, *a);
+        Iterator src = take_b ? b : a;
+        *out++ = *src;
+        b += take_b;
+        a += !take_b;
+    }
+    out = std::copy(a, a_end, out);
+    return std::copy(b, b_end, out);
+}
+
+//! bit layouts of items merged as whole unsigned words by bitonic_merge()
+enum class WordOrder {
+    //! item is a 32-bit unsigned key
+    Word32,
+    //! item is a 64-bit unsigned key
+    Word64,
+    //! 32-bit key followed by a 32-bit payload, e.g. MyStruct, ordered by key
+    //! and then payload
+    Key32Payload32
+};
+
+#if MBM_SIMD_SMALL_SORT_AVX2
+
+//! merge network operations on whole words, order() maps a word to an
+//! unsigned integer ordered like the item
+template <WordOrder Order>
+struct Avx2WordOps;
+
+template <>
+struct Avx2WordOps<WordOrder::Word32> : public simd_small_sort::Avx2Ops32 {
+    static Key order(Key w) {
+        return w;
+    }
+};
+
+template <>
+struct Avx2WordOps<WordOrder::Word64> : public simd_small_sort::Avx2Ops64 {
+    static Key order(Key w) {
+        return w;
+    }
+};
+
+template <>
+struct Avx2WordOps<WordOrder::Key32Payload32>
+    : public simd_small_sort::Avx2Ops64 {
+    //! compare with the key moved to the upper half of the lanes
+    MBM_TARGET_AVX2 static __m256i greater(__m256i a, __m256i b) {
+        return Avx2Ops64::greater(
+            _mm256_shuffle_epi32(a, 0xB1), _mm256_shuffle_epi32(b, 0xB1));
+    }
+    static Key order(Key w) {
+        return (w << 32) | (w >> 32);
+    }
+};
+
+template <typename Ops>
+MBM_TARGET_AVX2 static inline __m256i reverse_lanes(__m256i v) {
+    if (Ops::lanes == 4)
+        return _mm256_permute4x64_epi64(v, 0x1B);
+    return _mm256_permutevar8x32_epi32(
+        v, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+}
+
+//! sort the bitonic lanes of v by half-cleaners of distances lanes/2 to 1
+template <typename Ops>
+MBM_TARGET_AVX2 static inline __m256i bitonic_clean(__m256i v) {
+    for (size_t j = Ops::lanes / 2; j >= 1; j /= 2) {
+        __m256i p = Ops::partner(v, j);
+        __m256i g = Ops::greater(v, p);
+        __m256i min = _mm256_blendv_epi8(v, p, g);
+        __m256i max = _mm256_blendv_epi8(p, v, g);
+        __m256i lower = Ops::bit_zero(Ops::index(0), j);
+        v = _mm256_blendv_epi8(max, min, lower);
+    }
+    return v;
+}
+
+//! load up to lanes items, padding the lanes after rest with maximum words
+template <typename Ops, typename Item>
+MBM_TARGET_AVX2 static inline __m256i load_block(const Item* p, size_t rest) {
+    using Key = typename Ops::Key;
+    if (rest >= Ops::lanes)
+        return simd_small_sort::load(reinterpret_cast<const Key*>(p));
+    alignas(32) Key pad[Ops::lanes];
+    std::fill(pad, pad + Ops::lanes, std::numeric_limits<Key>::max());
+    std::memcpy(pad, p, rest * sizeof(Item));
+    return simd_small_sort::load(pad);
+}
+
+//! store the first min(lanes, rest) lanes, return their number
+template <typename Ops, typename Item>
+MBM_TARGET_AVX2 static inline size_t store_block(
+    Item* p, size_t rest, __m256i v) {
+    using Key = typename Ops::Key;
+    if (rest >= Ops::lanes) {
+        simd_small_sort::store(reinterpret_cast<Key*>(p), v);
+        return Ops::lanes;
+    }
+    alignas(32) Key block[Ops::lanes];
+    simd_small_sort::store(block, v);
+    std::memcpy(p, block, rest * sizeof(Item));
+    return rest;
+}
+
+/*!
+ * Merge a[0,na) and b[0,nb) into out[0,na+nb). Both inputs are read as
+ * sequences of lanes-sized blocks, the last one padded with maximum words.
+ * Each step merges the register of carried-over items with the next block
+ * of the input with the smaller head by a bitonic merge network, emits the
+ * lower half and carries the upper half. Padding sorts behind all items, or
+ * between equal maximum words, and is cut off at the end of out.
+ */
+template <typename Ops, typename Item>
+MBM_TARGET_AVX2
+void merge_avx2(const Item* a, size_t na, const Item* b, size_t nb,
+    Item* out) {
+    using Key = typename Ops::Key;
+    static_assert(sizeof(Item) == sizeof(Key), "Item must be one word");
+    const size_t lanes = Ops::lanes;
+    const Item* a_end = a + na, * b_end = b + nb;
+    Item* out_end = out + na + nb;
+
+    auto head = [](const Item* p) {
+        Key w;
+        std::memcpy(&w, p, sizeof(w));
+        return Ops::order(w);
+    };
+
+    __m256i carry = load_block<Ops>(a, na);
+    a += std::min(lanes, na);
+    __m256i next = load_block<Ops>(b, nb);
+    b += std::min(lanes, nb);
+
+    while (true) {
+        // bitonic merge of carry and reversed next, then clean both halves
+        next = reverse_lanes<Ops>(next);
+        __m256i g = Ops::greater(carry, next);
+        __m256i lo = bitonic_clean<Ops>(_mm256_blendv_epi8(carry, next, g));
+        carry = bitonic_clean<Ops>(_mm256_blendv_epi8(next, carry, g));
+        out += store_block<Ops>(out, out_end - out, lo);
+
+        bool take_a;
+        if (a == a_end) {
+            if (b == b_end)
+                break;
+            take_a = false;
+        }
+        else {
+            take_a = b == b_end || head(a) <= head(b);
+        }
+        const Item*& src = take_a ? a : b;
+        size_t rest = (take_a ? a_end : b_end) - src;
+        next = load_block<Ops>(src, rest);
+        src += std::min(lanes, rest);
+    }
+    store_block<Ops>(out, out_end - out, carry);
+}
+
+#endif // MBM_SIMD_SMALL_SORT_AVX2
+
+/*!
+ * Merge a[0,na) and b[0,nb) of items which are unsigned words in the given
+ * layout into out, with AVX2 if the CPU supports it (checked at run-time),
+ * otherwise with branchless_merge(). cmp must order like the words.
+ */
+template <WordOrder Order, bool UseSimd = true, typename Item,
+          typename Compare>
+void bitonic_merge(const Item* a, size_t na, const Item* b, size_t nb,
+    Item* out, Compare cmp) {
+#if MBM_SIMD_SMALL_SORT_AVX2
+    if (UseSimd && simd_small_sort::have_avx2() && na != 0 && nb != 0)
+        return merge_avx2<Avx2WordOps<Order>>(a, na, b, nb, out);
+#endif
+    branchless_merge(a, a + na, b, b + nb, out, cmp);
+}
+
+/******************************************************************************/
+// Cascade of Two-Way Merges
+
+/*!
+ * Merge the sorted runs data[bounds[i],bounds[i+1]) in rounds of two-way
+ * merges of adjacent runs, alternating between data and temp, which is
+ * ceil(log2(k)) passes over all items. merge2(a, a_end, b, b_end, out) merges
+ * two runs. bounds is reduced to the final run, returns the array holding
+ * it.
+ */
+template <typename Iterator, typename Merge2>
+Iterator cascade_merge(Iterator data, Iterator temp,
+    std::vector<size_t>& bounds, Merge2 merge2) {
+    while (bounds.size() > 2) {
+        size_t w = 1;
+        for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+            if (i + 2 < bounds.size()) {
+                merge2(data + bounds[i], data + bounds[i + 1],
+                    data + bounds[i + 1], data + bounds[i + 2],
+                    temp + bounds[i]);
+                bounds[w++] = bounds[i + 2];
+            }
+            else {
+                // odd run out is copied to the other array
+                std::copy(data + bounds[i], data + bounds[i + 1],
+                    temp + bounds[i]);
+                bounds[w++] = bounds[i + 1];
+            }
+        }
+        bounds.resize(w);
+        std::swap(data, temp);
+    }
+    return data;
+}
+
+/******************************************************************************/
+// K-Way Merges
+
+/*!
+ * Merge the sequences [seqs_begin,seqs_end), pairs of iterators as for
+ * tlx::multiway_merge(), into target. The heads are copied into a
+ * std::priority_queue with their sequence index, each output item costs a
+ * pop and a push of about 2 log2(k) comparisons. Advances the sequences.
+ */
+template <typename SeqIterator, typename OutIterator, typename Compare>
+OutIterator heap_merge(SeqIterator seqs_begin, SeqIterator seqs_end,
+    OutIterator target, Compare cmp) {
+    using Iterator = typename std::iterator_traits<SeqIterator>::value_type::
+        first_type;
+    using Item = typename std::iterator_traits<Iterator>::value_type;
+    using Entry = std::pair<Item, size_t>;
+
+    auto greater = [&](const Entry& x, const Entry& y) {
+        return cmp(y.first, x.first);
+    };
+    std::vector<Entry> heap;
+    heap.reserve(seqs_end - seqs_begin);
+    std::priority_queue<Entry, std::vector<Entry>, decltype(greater)> pq(
+        greater, std::move(heap));
+
+    for (SeqIterator s = seqs_begin; s != seqs_end; ++s) {
+        if (s->first != s->second)
+            pq.emplace(*s->first++, s - seqs_begin);
+    }
+    while (!pq.empty()) {
+        *target++ = pq.top().first;
+        size_t s = pq.top().second;
+        pq.pop();
+        if (seqs_begin[s].first != seqs_begin[s].second)
+            pq.emplace(*seqs_begin[s].first++, s);
+    }
+    return target;
+}
+
+/*!
+ * Merge the sequences with a tlx::LoserTree, whose exhausted sources are
+ * marked as supremum and checked at every comparison of the replayed path.
+ * Advances the sequences.
+ */
+template <typename SeqIterator, typename OutIterator, typename Compare>
+OutIterator loser_tree_merge(SeqIterator seqs_begin, SeqIterator seqs_end,
+    OutIterator target, Compare cmp) {
+    using Iterator = typename std::iterator_traits<SeqIterator>::value_type::
+        first_type;
+    using Item = typename std::iterator_traits<Iterator>::value_type;
+    using LoserTree = tlx::LoserTree<false, Item, Compare>;
+    using Source = typename LoserTree::Source;
+
+    const Source k = static_cast<Source>(seqs_end - seqs_begin);
+    size_t size = 0;
+    LoserTree lt(k, cmp);
+    for (Source s = 0; s < k; ++s) {
+        auto& seq = seqs_begin[s];
+        size += seq.second - seq.first;
+        if (seq.first == seq.second)
+            lt.insert_start(nullptr, s, true);
+        else
+            lt.insert_start(&*seq.first, s, false);
+    }
+    lt.init();
+
+    for (size_t i = 0; i < size; ++i) {
+        auto& seq = seqs_begin[lt.min_source()];
+        *target++ = *seq.first++;
+        if (seq.first == seq.second)
+            lt.delete_min_insert(nullptr, true);
+        else
+            lt.delete_min_insert(&*seq.first, false);
+    }
+    return target;
+}
+
+/*!
+ * Merge the sequences with a tlx::LoserTreeUnguarded, which compares without
+ * supremum checks. Exhausted sources insert a sentinel, the largest last item
+ * of all sequences. Only once a sentinel wins, all remaining items compare
+ * equal to it and are appended in sequence order. Advances the sequences.
+ */
+template <typename SeqIterator, typename OutIterator, typename Compare>
+OutIterator sentinel_loser_tree_merge(SeqIterator seqs_begin,
+    SeqIterator seqs_end, OutIterator target, Compare cmp) {
+    using Iterator = typename std::iterator_traits<SeqIterator>::value_type::
+        first_type;
+    using Item = typename std::iterator_traits<Iterator>::value_type;
+    using LoserTree = tlx::LoserTreeUnguarded<false, Item, Compare>;
+    using Source = typename LoserTree::Source;
+
+    const Source k = static_cast<Source>(seqs_end - seqs_begin);
+    const Item* max = nullptr;
+    for (SeqIterator s = seqs_begin; s != seqs_end; ++s) {
+        if (s->first != s->second &&
+            (max == nullptr || cmp(*max, *(s->second - 1))))
+            max = &*(s->second - 1);
+    }
+    if (max == nullptr)
+        return target;
+    const Item sentinel = *max;
+
+    LoserTree lt(k, sentinel, cmp);
+    for (Source s = 0; s < k; ++s) {
+        auto& seq = seqs_begin[s];
+        lt.insert_start(
+            seq.first == seq.second ? &sentinel : &*seq.first, s, false);
+    }
+    lt.init();
+
+    while (true) {
+        auto& seq = seqs_begin[lt.min_source()];
+        if (seq.first == seq.second)
+            break;
+        *target++ = *seq.first++;
+        lt.delete_min_insert(
+            seq.first == seq.second ? &sentinel : &*seq.first, false);
+    }
+    for (SeqIterator s = seqs_begin; s != seqs_end; ++s) {
+        target = std::copy(s->first, s->second, target);
+        s->first = s->second;
+    }
+    return target;
+}
+
+} // namespace merging
+
+#endif // !MBM_SORT_EXTRA_MERGE_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,289 @@
+/*******************************************************************************
+ * sort/extra/simd_small_sort.hpp
+ *
+ * Sorter for small arrays of up to 256 items with 32- or 64-bit unsigned keys.
+ * The keys are copied into an array padded to a power of two, together with
+ * the item positions as payload, and sorted by a bitonic sorting network. The
+ * compare-exchange steps run on AVX2 registers if the CPU supports it
+ * (checked at run-time), otherwise on scalars. Finally the items are permuted
+ * in-place to the order of the sorted positions.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_EXTRA_SIMD_SMALL_SORT_HEADER
+#define MBM_SORT_EXTRA_SIMD_SMALL_SORT_HEADER
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MBM_SIMD_SMALL_SORT_AVX2 1
+#include <immintrin.h>
+#define MBM_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MBM_SIMD_SMALL_SORT_AVX2 0
+#endif
+
+namespace simd_small_sort {
+
+//! largest number of items sorted by the network
+static const size_t max_size = 256;
+
+//! smallest padded network size, a multiple of the AVX2 lanes
+static const size_t min_network = 8;
+
+//! whether the CPU supports AVX2, checked once
+static inline bool have_avx2() {
+#if MBM_SIMD_SMALL_SORT_AVX2
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+/******************************************************************************/
+// Scalar Network
+
+/*!
+ * Bitonic sort of keys[0,m) with vals[0,m) as payload, m a power of two.
+ * Stage (k,j) compares i and i^j, ascending if bit k of i is zero.
+ */
+template <typename Key>
+void bitonic_sort_scalar(Key* keys, Key* vals, size_t m) {
+    for (size_t k = 2; k <= m; k *= 2) {
+        for (size_t j = k / 2; j > 0; j /= 2) {
+            for (size_t i = 0; i < m; ++i) {
+                size_t l = i ^ j;
+                if (l < i)
+                    continue;
+                bool ascending = (i & k) == 0;
+                if ((keys[l] < keys[i]) == ascending) {
+                    std::swap(keys[i], keys[l]);
+                    std::swap(vals[i], vals[l]);
+                }
+            }
+        }
+    }
+}
+
+/******************************************************************************/
+// AVX2 Network
+
+#if MBM_SIMD_SMALL_SORT_AVX2
+
+//! AVX2 operations on 8 lanes of uint32_t
+struct Avx2Ops32 {
+    using Key = uint32_t;
+    static const size_t lanes = 8;
+
+    //! lanes where a > b as unsigned integers
+    MBM_TARGET_AVX2 static __m256i greater(__m256i a, __m256i b) {
+        const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+        return _mm256_cmpgt_epi32(
+            _mm256_xor_si256(a, bias), _mm256_xor_si256(b, bias));
+    }
+    //! exchange lanes l and l^j for j < lanes
+    MBM_TARGET_AVX2 static __m256i partner(__m256i a, size_t j) {
+        switch (j) {
+        case 4:
+            return _mm256_permute2x128_si256(a, a, 0x01);
+        case 2:
+            return _mm256_shuffle_epi32(a, 0x4E);
+        default:
+            return _mm256_shuffle_epi32(a, 0xB1);
+        }
+    }
+    //! lane indexes base + [0,lanes)
+    MBM_TARGET_AVX2 static __m256i index(size_t base) {
+        return _mm256_add_epi32(
+            _mm256_set1_epi32(static_cast<int>(base)),
+            _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+    //! lanes where bit of g is zero
+    MBM_TARGET_AVX2 static __m256i bit_zero(__m256i g, size_t bit) {
+        return _mm256_cmpeq_epi32(
+            _mm256_and_si256(g, _mm256_set1_epi32(static_cast<int>(bit))),
+            _mm256_setzero_si256());
+    }
+    MBM_TARGET_AVX2 static __m256i cmpeq(__m256i a, __m256i b) {
+        return _mm256_cmpeq_epi32(a, b);
+    }
+};
+
+//! AVX2 operations on 4 lanes of uint64_t
+struct Avx2Ops64 {
+    using Key = uint64_t;
+    static const size_t lanes = 4;
+
+    MBM_TARGET_AVX2 static __m256i greater(__m256i a, __m256i b) {
+        const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+        return _mm256_cmpgt_epi64(
+            _mm256_xor_si256(a, bias), _mm256_xor_si256(b, bias));
+    }
+    MBM_TARGET_AVX2 static __m256i partner(__m256i a, size_t j) {
+        if (j == 2)
+            return _mm256_permute2x128_si256(a, a, 0x01);
+        return _mm256_shuffle_epi32(a, 0x4E);
+    }
+    MBM_TARGET_AVX2 static __m256i index(size_t base) {
+        return _mm256_add_epi64(
+            _mm256_set1_epi64x(static_cast<int64_t>(base)),
+            _mm256_setr_epi64x(0, 1, 2, 3));
+    }
+    MBM_TARGET_AVX2 static __m256i bit_zero(__m256i g, size_t bit) {
+        return _mm256_cmpeq_epi64(
+            _mm256_and_si256(g, _mm256_set1_epi64x(static_cast<int64_t>(bit))),
+            _mm256_setzero_si256());
+    }
+    MBM_TARGET_AVX2 static __m256i cmpeq(__m256i a, __m256i b) {
+        return _mm256_cmpeq_epi64(a, b);
+    }
+};
+
+template <typename Key>
+MBM_TARGET_AVX2 static inline __m256i load(const Key* p) {
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+template <typename Key>
+MBM_TARGET_AVX2 static inline void store(Key* p, __m256i v) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+/*!
+ * Bitonic sort as bitonic_sort_scalar(), m a power of two and at least the
+ * number of lanes. Stages with j >= lanes compare two whole registers, stages
+ * with j < lanes compare lanes within one register with its permutation.
+ */
+template <typename Ops>
+MBM_TARGET_AVX2
+void bitonic_sort_avx2(typename Ops::Key* keys, typename Ops::Key* vals,
+    size_t m) {
+    const size_t lanes = Ops::lanes;
+
+    for (size_t k = 2; k <= m; k *= 2) {
+        for (size_t j = k / 2; j > 0; j /= 2) {
+            if (j >= lanes) {
+                for (size_t i = 0; i < m; i += 2 * j) {
+                    for (size_t t = i; t < i + j; t += lanes) {
+                        __m256i a = load(keys + t), b = load(keys + t + j);
+                        __m256i va = load(vals + t), vb = load(vals + t + j);
+                        __m256i swap = (t & k) == 0 ? Ops::greater(a, b)
+                                                    : Ops::greater(b, a);
+                        store(keys + t, _mm256_blendv_epi8(a, b, swap));
+                        store(keys + t + j, _mm256_blendv_epi8(b, a, swap));
+                        store(vals + t, _mm256_blendv_epi8(va, vb, swap));
+                        store(vals + t + j, _mm256_blendv_epi8(vb, va, swap));
+                    }
+                }
+            }
+            else {
+                for (size_t t = 0; t < m; t += lanes) {
+                    __m256i a = load(keys + t), p = Ops::partner(a, j);
+                    __m256i g = Ops::index(t);
+                    // a lane keeps the minimum if it is the lower lane of an
+                    // ascending pair or the upper lane of a descending pair
+                    __m256i keep_min =
+                        Ops::cmpeq(Ops::bit_zero(g, j), Ops::bit_zero(g, k));
+                    __m256i take = _mm256_blendv_epi8(
+                        Ops::greater(p, a), Ops::greater(a, p), keep_min);
+                    __m256i va = load(vals + t);
+                    store(keys + t, _mm256_blendv_epi8(a, p, take));
+                    store(vals + t, _mm256_blendv_epi8(
+                                        va, Ops::partner(va, j), take));
+                }
+            }
+        }
+    }
+}
+
+#endif // MBM_SIMD_SMALL_SORT_AVX2
+
+//! sort keys[0,m) with payload vals[0,m), dispatched on the CPU features
+template <bool UseSimd, typename Key>
+void bitonic_sort(Key* keys, Key* vals, size_t m) {
+#if MBM_SIMD_SMALL_SORT_AVX2
+    if (UseSimd && have_avx2()) {
+        using Ops = typename std::conditional<
+            sizeof(Key) == 4, Avx2Ops32, Avx2Ops64>::type;
+        return bitonic_sort_avx2<Ops>(keys, vals, m);
+    }
+#endif
+    bitonic_sort_scalar(keys, vals, m);
+}
+
+/******************************************************************************/
+
+/*!
+ * Sort [begin,end) by the unsigned 32- or 64-bit key(item). Ranges larger than
+ * max_size are passed to std::sort. UseSimd = false selects the scalar network
+ * for comparison.
+ */
+template <bool UseSimd = true, typename Iterator, typename KeyGetter>
+void sort(Iterator begin, Iterator end, KeyGetter key) {
+    using Key = typename std::decay<decltype(key(*begin))>::type;
+    static_assert(std::is_unsigned<Key>::value &&
+                  (sizeof(Key) == 4 || sizeof(Key) == 8),
+                  "Key must be a 32- or 64-bit unsigned integer");
+
+    const size_t n = end - begin;
+    if (n <= 1)
+        return;
+    if (n > max_size) {
+        std::sort(begin, end, [&](const auto& a, const auto& b) {
+            return key(a) < key(b);
+        });
+        return;
+    }
+
+    size_t m = min_network;
+    while (m < n)
+        m *= 2;
+
+    alignas(32) Key keys[max_size], pos[max_size];
+    for (size_t i = 0; i < n; ++i)
+        keys[i] = key(begin[i]), pos[i] = i;
+    for (size_t i = n; i < m; ++i)
+        keys[i] = std::numeric_limits<Key>::max(), pos[i] = i;
+
+    bitonic_sort<UseSimd>(keys, pos, m);
+
+    // drop the padding, which may be interleaved with items of maximum key
+    size_t w = 0;
+    for (size_t i = 0; i < m; ++i) {
+        if (pos[i] < n)
+            pos[w++] = pos[i];
+    }
+
+    // permute items along the cycles of out[i] = in[pos[i]], mark done by
+    // setting pos[i] = i.
+    for (size_t i = 0; i < n; ++i) {
+        if (pos[i] == i)
+            continue;
+        auto tmp = std::move(begin[i]);
+        size_t j = i;
+        while (pos[j] != i) {
+            size_t next = pos[j];
+            begin[j] = std::move(begin[next]);
+            pos[j] = j;
+            j = next;
+        }
+        begin[j] = std::move(tmp);
+        pos[j] = j;
+    }
+}
+
+} // namespace simd_small_sort
+
+#endif // !MBM_SORT_EXTRA_SIMD_SMALL_SORT_HEADER
+
+/******************************************************************************/
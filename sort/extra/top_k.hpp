@@ -0,0 +1,207 @@
+/*******************************************************************************
+ * sort/extra/top_k.hpp
+ *
+ * Selection of the k smallest items of a range in ascending order, without
+ * sorting or reordering the whole range: a bounded max-heap, a tournament tree
+ * replaying one leaf-to-root path per accepted item, and a filter which
+ * discards items by key against a threshold with AVX2 compares and only
+ * collects the survivors.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_EXTRA_TOP_K_HEADER
+#define MBM_SORT_EXTRA_TOP_K_HEADER
+
+#include "simd_small_sort.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace top_k {
+
+/******************************************************************************/
+// Heap
+
+/*!
+ * Write the k smallest items of [begin,end) in ascending order to out[0,k),
+ * 1 <= k <= end - begin. out is a max-heap of the candidates, whose top is
+ * replaced by each smaller item.
+ */
+template <typename Iterator, typename OutIterator, typename Compare>
+void heap_select(Iterator begin, Iterator end, size_t k, OutIterator out,
+    Compare cmp) {
+    std::copy(begin, begin + k, out);
+    std::make_heap(out, out + k, cmp);
+    for (Iterator it = begin + k; it != end; ++it) {
+        if (!cmp(*it, *out))
+            continue;
+        std::pop_heap(out, out + k, cmp);
+        out[k - 1] = *it;
+        std::push_heap(out, out + k, cmp);
+    }
+    std::sort_heap(out, out + k, cmp);
+}
+
+/******************************************************************************/
+// Tournament Tree
+
+/*!
+ * Write the k smallest items of [begin,end) in ascending order to out[0,k),
+ * 1 <= k <= end - begin, using tree[0,2k) as scratch. The candidates in out
+ * are the leaves of a tournament tree whose inner nodes tree[1,k) hold the
+ * losers, i.e. the smaller item, and tree[0] the overall winner, the largest
+ * candidate. Replacing the winner replays only its path with one comparison
+ * per level, instead of the two of a heap sift-down.
+ */
+template <typename Iterator, typename OutIterator, typename Compare>
+void tournament_select(Iterator begin, Iterator end, size_t k,
+    OutIterator out, size_t* tree, Compare cmp) {
+    std::copy(begin, begin + k, out);
+
+    // leaf i is node k + i, inner node n has the children 2n and 2n + 1.
+    // Build bottom-up, keeping the winners of inner nodes in tree[k + n].
+    size_t* winner = tree + k;
+    auto node_winner = [&](size_t n) { return n >= k ? n - k : winner[n]; };
+    for (size_t n = k - 1; n >= 1; --n) {
+        size_t l = node_winner(2 * n), r = node_winner(2 * n + 1);
+        bool left_wins = cmp(out[r], out[l]);
+        winner[n] = left_wins ? l : r;
+        tree[n] = left_wins ? r : l;
+    }
+    tree[0] = node_winner(1);
+
+    for (Iterator it = begin + k; it != end; ++it) {
+        if (!cmp(*it, out[tree[0]]))
+            continue;
+        size_t cur = tree[0];
+        out[cur] = *it;
+        for (size_t n = (k + cur) / 2; n >= 1; n /= 2) {
+            if (cmp(out[cur], out[tree[n]]))
+                std::swap(cur, tree[n]);
+        }
+        tree[0] = cur;
+    }
+    std::sort(out, out + k, cmp);
+}
+
+/******************************************************************************/
+// SIMD Filter
+
+//! items scanned per block of extracted keys
+static const size_t filter_block = 256;
+
+//! size of the candidate buffer of filter_select()
+static inline size_t filter_buffer_size(size_t k) {
+    return 2 * k + filter_block;
+}
+
+//! append the indexes of keys[i,n) less than threshold to idx, return count
+template <typename Key>
+size_t filter_scalar(const Key* keys, size_t i, size_t n, Key threshold,
+    uint32_t* idx) {
+    size_t m = 0;
+    for (; i < n; ++i) {
+        idx[m] = static_cast<uint32_t>(i);
+        m += keys[i] < threshold;
+    }
+    return m;
+}
+
+#if MBM_SIMD_SMALL_SORT_AVX2
+
+//! as filter_scalar() on keys[0,n), n a multiple of the lanes. Lanes without
+//! any key below the threshold cost one compare and one movemask.
+template <typename Ops>
+MBM_TARGET_AVX2
+size_t filter_avx2(const typename Ops::Key* keys, size_t n,
+    typename Ops::Key threshold, uint32_t* idx) {
+    using Key = typename Ops::Key;
+    const __m256i t = sizeof(Key) == 4
+                      ? _mm256_set1_epi32(static_cast<int>(threshold))
+                      : _mm256_set1_epi64x(static_cast<int64_t>(threshold));
+    size_t m = 0;
+    for (size_t i = 0; i < n; i += Ops::lanes) {
+        __m256i less = Ops::greater(t, simd_small_sort::load(keys + i));
+        unsigned mask = sizeof(Key) == 4
+                        ? _mm256_movemask_ps(_mm256_castsi256_ps(less))
+                        : _mm256_movemask_pd(_mm256_castsi256_pd(less));
+        for (; mask; mask &= mask - 1)
+            idx[m++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+    }
+    return m;
+}
+
+#endif // MBM_SIMD_SMALL_SORT_AVX2
+
+/*!
+ * Write the k smallest items of [begin,end) in ascending order to
+ * buffer[0,k), 1 <= k <= end - begin, with buffer of filter_buffer_size(k)
+ * items. The unsigned key(item) must order like cmp. Items are scanned in
+ * blocks whose keys are extracted and compared against the key of the k-th
+ * smallest candidate so far, survivors are appended to the buffer, which is
+ * shrunk back to k candidates by nth_element when full.
+ */
+template <bool UseSimd = true, typename Iterator, typename OutIterator,
+          typename KeyGetter, typename Compare>
+void filter_select(Iterator begin, Iterator end, size_t k, OutIterator buffer,
+    KeyGetter key, Compare cmp) {
+    using Key = typename std::decay<decltype(key(*begin))>::type;
+    static_assert(std::is_unsigned<Key>::value &&
+                  (sizeof(Key) == 4 || sizeof(Key) == 8),
+                  "Key must be a 32- or 64-bit unsigned integer");
+
+    const size_t capacity = filter_buffer_size(k);
+    std::copy(begin, begin + k, buffer);
+    std::nth_element(buffer, buffer + (k - 1), buffer + k, cmp);
+    Key threshold = key(buffer[k - 1]);
+    size_t size = k;
+
+    alignas(32) Key keys[filter_block];
+    uint32_t idx[filter_block];
+
+    for (Iterator block = begin + k; block != end;) {
+        size_t n = std::min<size_t>(filter_block, end - block);
+        for (size_t i = 0; i < n; ++i)
+            keys[i] = key(block[i]);
+
+        size_t m;
+#if MBM_SIMD_SMALL_SORT_AVX2
+        if (UseSimd && simd_small_sort::have_avx2()) {
+            using Ops = typename std::conditional<sizeof(Key) == 4,
+                simd_small_sort::Avx2Ops32, simd_small_sort::Avx2Ops64>::type;
+            size_t full = n - n % Ops::lanes;
+            m = filter_avx2<Ops>(keys, full, threshold, idx);
+            m += filter_scalar(keys, full, n, threshold, idx + m);
+        }
+        else
+#endif
+        {
+            m = filter_scalar(keys, 0, n, threshold, idx);
+        }
+
+        for (size_t j = 0; j < m; ++j)
+            buffer[size++] = block[idx[j]];
+        block += n;
+
+        if (size + filter_block > capacity) {
+            std::nth_element(buffer, buffer + (k - 1), buffer + size, cmp);
+            size = k;
+            threshold = key(buffer[k - 1]);
+        }
+    }
+
+    std::nth_element(buffer, buffer + (k - 1), buffer + size, cmp);
+    std::sort(buffer, buffer + k, cmp);
+}
+
+} // namespace top_k
+
+#endif // !MBM_SORT_EXTRA_TOP_K_HEADER
+
+/******************************************************************************/
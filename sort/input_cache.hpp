@@ -0,0 +1,150 @@
+/*******************************************************************************
+ * sort/input_cache.hpp
+ *
+ * Persistent cache of generated sort inputs, shared between repetitions and
+ * between the benchmark programs. Enabled by setting the environment variable
+ * MBM_SORT_INPUT_CACHE to a directory. Each (distribution, item type, size,
+ * seed) input is generated once into a file, which is later mapped read-only
+ * and copied into the benchmark buffer, so every sorter sees byte-identical
+ * data.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_INPUT_CACHE_HEADER
+#define MBM_SORT_INPUT_CACHE_HEADER
+
+#include "input_distributions.hpp"
+
+#include <tlx/logger.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <type_traits>
+
+//! bump when the generators change, so stale cache files are not used
+static const unsigned input_cache_version = 1;
+
+//! return cache directory from MBM_SORT_INPUT_CACHE or nullptr if disabled
+static inline const char* input_cache_directory() {
+    const char* dir = getenv("MBM_SORT_INPUT_CACHE");
+    return (dir && *dir) ? dir : nullptr;
+}
+
+//! construct cache file path for an input
+static inline std::string input_cache_path(const char* dir, Distribution d,
+    const char* item_name, size_t n, uint64_t seed) {
+    char name[256];
+    snprintf(name, sizeof(name), "/input-v%u-%s-%s-%zu-%llu.bin",
+        input_cache_version, distribution_name(d), item_name, n,
+        static_cast<unsigned long long>(seed));
+    return std::string(dir) + name;
+}
+
+//! map cache file and copy it into out. Returns false if not available.
+static inline bool input_cache_load(
+    const std::string& path, void* out, size_t bytes) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) != bytes) {
+        LOG1 << "input_cache: ignoring " << path << " with wrong size";
+        close(fd);
+        return false;
+    }
+
+    void* map = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG1 << "input_cache: mmap " << path << " error: " << strerror(errno);
+        return false;
+    }
+    madvise(map, bytes, MADV_SEQUENTIAL);
+
+    parallel_memcpy(out, map, bytes);
+
+    munmap(map, bytes);
+    return true;
+}
+
+//! write input to cache file via a temporary file and an atomic rename, so
+//! concurrently running benchmarks never read a partial file.
+static inline void input_cache_store(
+    const std::string& path, const void* data, size_t bytes) {
+    std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+
+    int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+        0644);
+    if (fd < 0) {
+        LOG1 << "input_cache: open " << tmp_path
+             << " error: " << strerror(errno);
+        return;
+    }
+
+    const char* p = static_cast<const char*>(data);
+    size_t rest = bytes;
+    while (rest > 0) {
+        ssize_t w = write(fd, p, rest);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG1 << "input_cache: write " << tmp_path
+                 << " error: " << strerror(errno);
+            close(fd);
+            unlink(tmp_path.c_str());
+            return;
+        }
+        p += w, rest -= w;
+    }
+    close(fd);
+
+    if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+        LOG1 << "input_cache: rename " << tmp_path
+             << " error: " << strerror(errno);
+        unlink(tmp_path.c_str());
+    }
+}
+
+/*!
+ * Fill out[0,n) like generate_input(), but take the items from the input cache
+ * if enabled, and store newly generated inputs there. The item_name must
+ * uniquely identify the item type and its construction from keys. Batches of
+ * segments are small and not cached.
+ */
+template <typename Key, typename Iterator>
+void generate_input_cached(Distribution d, Iterator out, size_t n,
+    uint64_t seed, const char* item_name, size_t segment = size_t(-1)) {
+    using Item = typename std::iterator_traits<Iterator>::value_type;
+    static_assert(std::is_trivially_copyable<Item>::value,
+        "cached items must be trivially copyable");
+
+    const char* dir = input_cache_directory();
+    if (!dir || n == 0 || segment < n)
+        return generate_input<Key>(d, out, n, seed, segment);
+
+    std::string path = input_cache_path(dir, d, item_name, n, seed);
+    Item* data = &*out;
+
+    if (input_cache_load(path, data, n * sizeof(Item)))
+        return;
+
+    generate_input<Key>(d, out, n, seed);
+    input_cache_store(path, data, n * sizeof(Item));
+}
+
+#endif // !MBM_SORT_INPUT_CACHE_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,423 @@
+/*******************************************************************************
+ * sort/input_distributions.hpp
+ *
+ * Input key distributions for the sorting benchmarks.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_INPUT_DISTRIBUTIONS_HEADER
+#define MBM_SORT_INPUT_DISTRIBUTIONS_HEADER
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <random>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+/******************************************************************************/
+
+enum class Distribution {
+    //! uniformly random keys over the whole key range
+    Uniform,
+    //! distinct keys in ascending order, spread over the key range
+    Sorted,
+    //! distinct keys in descending order
+    Reverse,
+    //! sorted keys with sqrt(n) random swaps
+    AlmostSorted,
+    //! only 16 distinct random keys
+    FewUnique,
+    //! Zipf distributed ranks with exponent 1.0, small keys are frequent
+    Zipf,
+    //! exponentially distributed keys concentrated in the low key range
+    Exponential,
+    //! ascending first half, descending second half
+    OrganPipe,
+    //! 16 ascending runs
+    Sawtooth,
+    //! all keys are equal
+    AllEqual,
+    //! 8 random bits replicated into every byte of the key
+    Entropy8,
+    //! uniformly random keys from [0, sqrt(n)), many duplicates
+    Duplicates,
+};
+
+static const Distribution all_distributions[] = {
+    Distribution::Uniform,   Distribution::Sorted,
+    Distribution::Reverse,   Distribution::AlmostSorted,
+    Distribution::FewUnique, Distribution::Zipf,
+    Distribution::Exponential, Distribution::OrganPipe,
+    Distribution::Sawtooth,  Distribution::AllEqual,
+    Distribution::Entropy8,  Distribution::Duplicates,
+};
+
+//! return RESULT name of a distribution
+static inline const char* distribution_name(Distribution d) {
+    switch (d) {
+    case Distribution::Uniform:
+        return "uniform";
+    case Distribution::Sorted:
+        return "sorted";
+    case Distribution::Reverse:
+        return "reverse";
+    case Distribution::AlmostSorted:
+        return "almost_sorted";
+    case Distribution::FewUnique:
+        return "few_unique";
+    case Distribution::Zipf:
+        return "zipf";
+    case Distribution::Exponential:
+        return "exponential";
+    case Distribution::OrganPipe:
+        return "organ_pipe";
+    case Distribution::Sawtooth:
+        return "sawtooth";
+    case Distribution::AllEqual:
+        return "all_equal";
+    case Distribution::Entropy8:
+        return "entropy8";
+    case Distribution::Duplicates:
+        return "duplicates";
+    }
+    return "unknown";
+}
+
+//! parse a distribution name, returns false if unknown
+static inline bool parse_distribution(const char* name, Distribution* d) {
+    for (Distribution x : all_distributions) {
+        if (strcmp(name, distribution_name(x)) == 0) {
+            *d = x;
+            return true;
+        }
+    }
+    return false;
+}
+
+/******************************************************************************/
+
+/*!
+ * Zipf distributed ranks in [1, n] with exponent s, using the
+ * rejection-inversion method of Hörmann and Derflinger, which needs no
+ * precomputed tables and only a few uniform variates per sample.
+ */
+class ZipfDistribution {
+public:
+    ZipfDistribution(double n, double s) : n_(n), s_(s) {
+        h_integral_x1_ = h_integral(1.5) - 1.0;
+        h_integral_n_ = h_integral(n_ + 0.5);
+        s_cut_ = 2.0 - h_integral_inverse(h_integral(2.5) - h(2.0));
+    }
+
+    template <typename RNG>
+    double operator()(RNG& rng) const {
+        std::uniform_real_distribution<double> uniform;
+        while (true) {
+            double u = h_integral_n_ +
+                       uniform(rng) * (h_integral_x1_ - h_integral_n_);
+            double x = h_integral_inverse(u);
+            double k = std::floor(x + 0.5);
+            if (k < 1)
+                k = 1;
+            else if (k > n_)
+                k = n_;
+            if (k - x <= s_cut_ || u >= h_integral(k + 0.5) - h(k))
+                return k;
+        }
+    }
+
+private:
+    double n_, s_;
+    double h_integral_x1_, h_integral_n_, s_cut_;
+
+    double h(double x) const {
+        return std::exp(-s_ * std::log(x));
+    }
+    double h_integral(double x) const {
+        double log_x = std::log(x);
+        return helper2((1.0 - s_) * log_x) * log_x;
+    }
+    double h_integral_inverse(double x) const {
+        double t = x * (1.0 - s_);
+        if (t < -1.0)
+            t = -1.0;
+        return std::exp(helper1(t) * x);
+    }
+    static double helper1(double x) {
+        if (std::abs(x) > 1e-8)
+            return std::log1p(x) / x;
+        return 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+    }
+    static double helper2(double x) {
+        if (std::abs(x) > 1e-8)
+            return std::expm1(x) / x;
+        return 1.0 + x * 0.5 * (1.0 + x * 1.0 / 3.0 * (1.0 + 0.25 * x));
+    }
+};
+
+/******************************************************************************/
+
+/*!
+ * Counter-based random number generator: a splitmix64 sequence starting at a
+ * position derived from (seed, counter). Each item index draws from its own
+ * stream, hence the generated input is identical for any number of threads.
+ */
+class SplitMix64 {
+public:
+    using result_type = uint64_t;
+
+    SplitMix64(uint64_t seed, uint64_t counter)
+        : state_(mix(seed + mix(counter))) {
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+
+    result_type operator()() {
+        return mix(state_ += 0x9E3779B97F4A7C15llu);
+    }
+
+    //! uniform double in [0,1)
+    double uniform() {
+        return static_cast<double>(operator()() >> 11) * 0x1.0p-53;
+    }
+
+    //! splitmix64 finalizer
+    static uint64_t mix(uint64_t z) {
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9llu;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBllu;
+        return z ^ (z >> 31);
+    }
+
+private:
+    uint64_t state_;
+};
+
+/*!
+ * Construct out[i] = Item(key_at(i)) in parallel. The static schedule
+ * first-touches the pages of out in contiguous per-thread ranges, which is
+ * also how the OpenMP-based sorters partition the array.
+ */
+template <typename Iterator, typename KeyAt>
+void parallel_fill(Iterator out, size_t n, KeyAt key_at) {
+    using Item = typename std::iterator_traits<Iterator>::value_type;
+
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < n; ++i)
+        new (&out[i]) Item(key_at(i));
+}
+
+//! call func(begin, end) for contiguous per-thread ranges of [0,n), like the
+//! static schedule of parallel_fill(), hence with the same first-touch layout.
+template <typename Func>
+void parallel_ranges(size_t n, Func func) {
+#pragma omp parallel
+    {
+#if defined(_OPENMP)
+        size_t p = omp_get_thread_num(), parts = omp_get_num_threads();
+#else
+        size_t p = 0, parts = 1;
+#endif
+        func(n * p / parts, n * (p + 1) / parts);
+    }
+}
+
+//! copy n bytes in contiguous per-thread ranges
+static inline void parallel_memcpy(void* dst, const void* src, size_t n) {
+    parallel_ranges(n, [&](size_t begin, size_t end) {
+        memcpy(static_cast<char*>(dst) + begin,
+            static_cast<const char*>(src) + begin, end - begin);
+    });
+}
+
+//! set n bytes in contiguous per-thread ranges
+static inline void parallel_memset(void* dst, int value, size_t n) {
+    parallel_ranges(n, [&](size_t begin, size_t end) {
+        memset(static_cast<char*>(dst) + begin, value, end - begin);
+    });
+}
+
+
+/*!
+ * Fill out[0,end-begin) with the items [begin,end) of an input of n items
+ * constructed from keys of the given distribution. Key is the unsigned integer
+ * key type whose range the distribution spans. The storage of out may be
+ * uninitialized. Slices of one input can be generated independently, e.g. to
+ * write inputs larger than the main memory.
+ */
+template <typename Key, typename Iterator>
+void generate_input_slice(Distribution d, Iterator out, size_t n,
+    uint64_t seed, size_t begin, size_t end) {
+    static_assert(std::is_unsigned<Key>::value, "Key must be unsigned");
+
+    const Key max_key = std::numeric_limits<Key>::max();
+    // step to spread n distinct ascending keys over the key range
+    const Key step = n <= 1 ? 1 : std::max<Key>(1, max_key / (n - 1));
+
+    //! construct out[i - begin] = Item(key_at(i)) for i in [begin,end)
+    auto fill = [&](auto key_at) {
+        parallel_fill(out, end - begin,
+            [&](size_t i) { return key_at(begin + i); });
+    };
+
+    switch (d) {
+    case Distribution::Uniform:
+        fill([&](size_t i) {
+            return static_cast<Key>(SplitMix64(seed, i)());
+        });
+        break;
+
+    case Distribution::Sorted:
+        fill([&](size_t i) {
+            return static_cast<Key>(i * step);
+        });
+        break;
+
+    case Distribution::Reverse:
+        fill([&](size_t i) {
+            return static_cast<Key>((n - 1 - i) * step);
+        });
+        break;
+
+    case Distribution::AlmostSorted: {
+        auto key_at = [&](size_t i) { return static_cast<Key>(i * step); };
+        fill(key_at);
+        if (n == 0)
+            break;
+        // the few swaps are drawn from a stream after the item indexes. They
+        // are replayed on the keys of the swapped positions only, then those
+        // in the slice are overwritten.
+        SplitMix64 rng(seed, n);
+        size_t swaps = static_cast<size_t>(std::sqrt(n));
+        std::unordered_map<size_t, Key> moved;
+        auto moved_key = [&](size_t x) -> Key& {
+            auto it = moved.find(x);
+            if (it == moved.end())
+                it = moved.emplace(x, key_at(x)).first;
+            return it->second;
+        };
+        for (size_t i = 0; i < swaps; ++i) {
+            size_t x = rng() % n, y = rng() % n;
+            std::swap(moved_key(x), moved_key(y));
+        }
+        using Item = typename std::iterator_traits<Iterator>::value_type;
+        for (const auto& m : moved) {
+            if (m.first >= begin && m.first < end)
+                out[m.first - begin] = Item(m.second);
+        }
+        break;
+    }
+
+    case Distribution::FewUnique: {
+        Key unique[16];
+        SplitMix64 rng(seed, n);
+        for (size_t i = 0; i < 16; ++i)
+            unique[i] = static_cast<Key>(rng());
+        fill([&](size_t i) {
+            return unique[SplitMix64(seed, i)() % 16];
+        });
+        break;
+    }
+
+    case Distribution::Zipf: {
+        const ZipfDistribution zipf(static_cast<double>(max_key), 1.0);
+        fill([&](size_t i) {
+            SplitMix64 rng(seed, i);
+            return static_cast<Key>(zipf(rng) - 1);
+        });
+        break;
+    }
+
+    case Distribution::Exponential: {
+        // mean at 1/64 of the key range
+        const double scale = static_cast<double>(max_key) / 64.0;
+        fill([&](size_t i) {
+            double x = -std::log1p(-SplitMix64(seed, i).uniform()) * scale;
+            return x >= static_cast<double>(max_key) ? max_key
+                                                     : static_cast<Key>(x);
+        });
+        break;
+    }
+
+    case Distribution::OrganPipe: {
+        const size_t half = n / 2;
+        const Key pipe_step = half <= 1 ? 1 : max_key / half;
+        fill([&](size_t i) {
+            return static_cast<Key>((i < half ? i : n - 1 - i) * pipe_step);
+        });
+        break;
+    }
+
+    case Distribution::Sawtooth: {
+        const size_t period = std::max<size_t>(1, (n + 15) / 16);
+        const Key saw_step = period <= 1 ? 1 : max_key / period;
+        fill([&](size_t i) {
+            return static_cast<Key>((i % period) * saw_step);
+        });
+        break;
+    }
+
+    case Distribution::AllEqual:
+        fill([&](size_t) { return Key(max_key / 2); });
+        break;
+
+    case Distribution::Entropy8: {
+        const Key ones = max_key / 255; // 0x0101...01
+        fill([&](size_t i) {
+            return static_cast<Key>((SplitMix64(seed, i)() & 0xFF) * ones);
+        });
+        break;
+    }
+
+    case Distribution::Duplicates: {
+        const size_t range = std::max<size_t>(1, std::sqrt(n));
+        fill([&](size_t i) {
+            return static_cast<Key>(SplitMix64(seed, i)() % range);
+        });
+        break;
+    }
+    }
+}
+
+/*!
+ * Fill out[0,n) with items constructed from keys of the given distribution.
+ * Key is the unsigned integer key type whose range the distribution spans.
+ * The storage of out may be uninitialized. If segment is less than n, out is
+ * a batch of independent inputs of segment items, the last one possibly
+ * shorter, each generated with its own seed.
+ */
+template <typename Key, typename Iterator>
+void generate_input(Distribution d, Iterator out, size_t n, uint64_t seed,
+    size_t segment = size_t(-1)) {
+    if (segment >= n)
+        return generate_input_slice<Key>(d, out, n, seed, 0, n);
+
+    // the fill of each segment runs on one thread of the outer loop
+    const size_t segments = (n + segment - 1) / segment;
+#pragma omp parallel for schedule(static)
+    for (size_t s = 0; s < segments; ++s) {
+        size_t m = std::min(segment, n - s * segment);
+        generate_input_slice<Key>(
+            d, out + s * segment, m, SplitMix64(seed, s)(), 0, m);
+    }
+}
+
+#endif // !MBM_SORT_INPUT_DISTRIBUTIONS_HEADER
+
+/******************************************************************************/
@@ -8,7 +8,7 @@
  * All rights reserved. Published under the MIT License in the LICENSE file.
  ******************************************************************************/
 
-#include <microbenchmarking.hpp>
+#include "sort_benchmark.hpp"
 
 #include <tlx/die.hpp>
 #include <tlx/string/contains.hpp>
@@ -16,6 +16,8 @@
 #include <algorithm>
 #include <iostream>
 #include <random>
+#include <utility>
+#include <vector>
 
 /******************************************************************************/
 // Settings
@@ -26,127 +28,338 @@ const size_t min_size = 64 * 1024;
 //! maximum number of items to insert
 const size_t max_size = 8 * 1024 * 1024;
 
-/******************************************************************************/
+//! evict CPU caches before each repetition
+const bool flush_cache = false;
+
+//! small-size sweep: largest array size
+const size_t small_max_size = 64 * 1024;
+
+//! small-size sweep: items per batch of independent arrays
+const size_t small_batch = 256 * 1024;
 
-struct MyStruct {
-    uint32_t a, b;
+//! small-size sweep: repetitions of each batch
+const size_t small_reps = 200;
 
-    explicit MyStruct(uint32_t x = 0) : a(x), b(x * x) {
+//! small-size sweep: sizes 4 to small_max_size in quarter steps between
+//! powers of two, e.g. 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, ...
+static std::vector<size_t> small_sizes() {
+    std::vector<size_t> sizes;
+    for (size_t p = 4; p <= small_max_size; p *= 2) {
+        for (size_t q = 4; q < 8; ++q) {
+            if (p * q / 4 <= small_max_size)
+                sizes.push_back(p * q / 4);
+        }
     }
+    return sizes;
+}
 
-    bool operator<(const MyStruct& other) const {
-        return a < other.a;
+/******************************************************************************/
+// Sequential Sorters
+
+//! order-preserving unsigned key of an item, for the radix sorters
+template <typename Item>
+struct ItemKey {
+    auto operator()(const Item& s) const {
+        return ItemTraits<Item>::key(s);
     }
+};
+
+template <typename Item>
+class StdSort : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
 
-    friend std::ostream& operator<<(std::ostream& os, const MyStruct& s) {
-        return os << '(' << s.a << ',' << s.b << ')';
+    StdSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
+    }
+    const char* name() const final {
+        return "std::sort";
+    }
+    void run() {
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            std::sort(begin, end, this->cmp_);
+        });
     }
 };
 
-class SortBenchmark {
+template <typename Item>
+class StdStableSort : public SortBenchmark<Item> {
 public:
-    std::vector<MyStruct> vec_;
-    std::less<MyStruct> cmp_;
+    using typename SortBenchmark<Item>::Iterator;
 
-    SortBenchmark(size_t size, size_t rep) {
-        std::mt19937 rng(123456 + rep);
-        std::uniform_int_distribution<uint32_t> distr;
+    static const bool stable = true;
 
-        vec_.resize(size);
-        for (unsigned int i = 0; i < size; ++i)
-            vec_[i] = MyStruct(distr(rng));
+    StdStableSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
     }
+    const char* name() const final {
+        return "std::stable_sort";
+    }
+    void run() {
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            std::stable_sort(begin, end, this->cmp_);
+        });
+    }
+};
 
-    void check() {
-        die_unless(std::is_sorted(vec_.begin(), vec_.end(), cmp_));
+#include "ips4o/ips4o.hpp"
+
+template <typename Item>
+class IPS4oSequentialSort : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
+
+    IPS4oSequentialSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
     }
+    const char* name() const final {
+        return "ips4o::(sequential_)sort";
+    }
+    void run() {
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            ips4o::sort(begin, end, this->cmp_);
+        });
+    }
+};
+
+#include <boost/sort/pdqsort/pdqsort.hpp>
 
-    virtual const char* name() const = 0;
+template <typename Item>
+class PdqSort : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
 
-    friend std::ostream& operator<<(std::ostream& os, const SortBenchmark& b) {
-        return os << "benchmark=" << b.name() << '\t'
-                  << "size=" << b.vec_.size() << '\t';
+    PdqSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
+    }
+    const char* name() const final {
+        return "boost::sort::pdqsort";
+    }
+    void run() {
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            boost::sort::pdqsort(begin, end, this->cmp_);
+        });
     }
 };
 
-/******************************************************************************/
-// Sequential Sorters
+#include "extra/block_quicksort.hpp"
 
-class StdSort : public SortBenchmark {
+template <typename Item>
+class BlockQuicksort : public SortBenchmark<Item> {
 public:
-    StdSort(size_t size, size_t rep) : SortBenchmark(size, rep) {
+    using typename SortBenchmark<Item>::Iterator;
+
+    BlockQuicksort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
     }
     const char* name() const final {
-        return "std::sort";
+        return "block_quicksort::sort";
     }
     void run() {
-        std::sort(vec_.begin(), vec_.end(), cmp_);
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            block_quicksort::sort(begin, end, this->cmp_);
+        });
     }
 };
 
-class StdStableSort : public SortBenchmark {
+//! insertion sort, only run on small arrays or segments
+template <typename Item>
+class InsertionSort : public SortBenchmark<Item> {
 public:
-    StdStableSort(size_t size, size_t rep) : SortBenchmark(size, rep) {
+    using typename SortBenchmark<Item>::Iterator;
+
+    static const size_t max_sort_size = 1024;
+
+    InsertionSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
     }
     const char* name() const final {
-        return "std::stable_sort";
+        return "insertion_sort";
     }
     void run() {
-        std::stable_sort(vec_.begin(), vec_.end(), cmp_);
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            block_quicksort::insertion_sort(begin, end, this->cmp_);
+        });
     }
 };
 
-#include "ips4o/ips4o.hpp"
+#include "extra/lsd_radix_sort.hpp"
 
-class IPS4oSequentialSort : public SortBenchmark {
+template <typename Item>
+class SequentialLSDRadixSort : public SortBenchmark<Item> {
 public:
-    IPS4oSequentialSort(size_t size, size_t rep) : SortBenchmark(size, rep) {
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+
+    static const bool stable = true;
+
+    //! scatter target of the odd passes
+    Array buffer_;
+
+    SequentialLSDRadixSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
+        this->allocate_scratch(buffer_, size);
     }
     const char* name() const final {
-        return "ips4o::(sequential_)sort";
+        return "lsd_radix_sort::sort";
     }
     void run() {
-        ips4o::sort(vec_.begin(), vec_.end(), cmp_);
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            lsd_radix_sort::sort(begin, end,
+                buffer_.begin() + (begin - this->vec_.begin()),
+                ItemKey<Item>());
+        });
     }
 };
 
-/******************************************************************************/
+#include "extra/american_flag_sort.hpp"
 
-template <typename Benchmark>
-void test_size(size_t size, size_t rep) {
+template <typename Item>
+class AmericanFlagSort : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
 
-    Microbenchmark mbm;
-    mbm.enable_hw_cpu_cycles();
-    mbm.enable_hw_instructions();
-    mbm.enable_hw_ref_cpu_cycles();
+    AmericanFlagSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
+    }
+    const char* name() const final {
+        return "american_flag_sort::sort";
+    }
+    void run() {
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            american_flag_sort::sort(begin, end, ItemKey<Item>());
+        });
+    }
+};
 
-    mbm.enable_hw_cache1(
-        PerfCache::L1I, PerfCacheOp::Read, PerfCacheOpResult::Miss);
-    mbm.enable_hw_cache2(
-        PerfCache::L1D, PerfCacheOp::Read, PerfCacheOpResult::Miss);
-    mbm.enable_hw_cache3(
-        PerfCache::LL, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+#include <tlx/algorithm/multiway_merge.hpp>
 
-    mbm.run_check_print(Benchmark(size, rep));
-}
+/*!
+ * Sequential multiway mergesort: sort runs of about 256 KiB with std::sort,
+ * then merge all runs of a segment with tlx's loser tree multiway merge into
+ * a second array, which is swapped with the input array at the end.
+ */
+template <typename Item>
+class SequentialMultiwayMergesort : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+
+    //! merge target, swapped with vec_ after each run
+    Array target_;
+    //! sorted runs, reserved outside of run()
+    std::vector<std::pair<Iterator, Iterator>> runs_;
+
+    //! items per sorted run
+    static const size_t run_size =
+        std::max<size_t>(1, 256 * 1024 / sizeof(Item));
+
+    SequentialMultiwayMergesort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
+        this->allocate_scratch(target_, size);
+        runs_.reserve((size + run_size - 1) / run_size);
+    }
+    const char* name() const final {
+        return "tlx::multiway_merge(sequential)";
+    }
+    void run() {
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            runs_.clear();
+            for (Iterator run = begin; run != end;) {
+                Iterator run_end =
+                    run + std::min<size_t>(run_size, end - run);
+                std::sort(run, run_end, this->cmp_);
+                runs_.emplace_back(run, run_end);
+                run = run_end;
+            }
+            tlx::multiway_merge(runs_.begin(), runs_.end(),
+                target_.begin() + (begin - this->vec_.begin()), end - begin,
+                this->cmp_);
+        });
+        this->vec_.swap(target_);
+    }
+};
 
-#define QUOTE(string) #string
+#include "extra/simd_small_sort.hpp"
 
-int main() {
-    for (size_t size = min_size; size <= max_size; size = 2 * size) {
-        size_t f = (8 * 1024 * 1024) / size;
-        for (size_t rep = 0; rep < std::max<size_t>(10, 100 * f); ++rep) {
-            // MBM_ALGORITHM is defined from cmake to select algorithm
-            test_size<MBM_ALGORITHM>(size, rep);
+//! SIMD bitonic network, larger arrays are sorted in segments of 256 items
+template <typename Item>
+class SimdSmallSort : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
 
-            // test_size<StdSort>(size, rep);
-            // test_size<StdStableSort>(size, rep);
-            // test_size<IPS4oSequentialSort>(size, rep);
+    static const size_t max_sort_size = simd_small_sort::max_size;
 
-            // test_size<IPS4oParallelSort>(size, rep);
-            // test_size<MCSTLParallelMergesort>(size, rep);
-        }
+    SimdSmallSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
+    }
+    const char* name() const final {
+        return "simd_small_sort::sort";
+    }
+    void run() {
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            simd_small_sort::sort(begin, end, ItemKey<Item>());
+        });
     }
+};
+
+//! the same bitonic network with scalar compare-exchanges
+template <typename Item>
+class ScalarNetworkSort : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
+
+    static const size_t max_sort_size = simd_small_sort::max_size;
+
+    ScalarNetworkSort(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
+    }
+    const char* name() const final {
+        return "simd_small_sort::sort<scalar>";
+    }
+    void run() {
+        this->for_each_segment([&](Iterator begin, Iterator end) {
+            simd_small_sort::sort</* UseSimd */ false>(
+                begin, end, ItemKey<Item>());
+        });
+    }
+};
+
+/******************************************************************************/
+
+int main(int argc, char* argv[]) {
+    // distributions and item types can be selected on the command line
+    SortSelection selection(argc, argv);
+
+    selection.for_each_item([&](auto tag) {
+        using Item = typename decltype(tag)::type;
+        // MBM_ALGORITHM is defined from cmake to select algorithm
+        using Benchmark = MBM_ALGORITHM<Item>;
+
+        for (Distribution distribution : selection.distributions_) {
+            if (selection.small_) {
+                for (size_t size : small_sizes()) {
+                    if (size > Benchmark::max_sort_size)
+                        break;
+                    // batch of independent arrays
+                    size_t batch = std::max<size_t>(1, small_batch / size);
+                    test_size<Benchmark>(batch * size, small_reps,
+                        distribution, flush_cache, size);
+                }
+                continue;
+            }
+
+            // limit the bytes of the items and their storage to those of
+            // max_size MyStruct items
+            size_t max_items = max_size * sizeof(MyStruct) / item_bytes<Item>();
+
+            for (size_t size = min_size; size <= max_items; size = 2 * size) {
+                size_t f = (8 * 1024 * 1024) / size;
+                size_t reps = std::max<size_t>(10, 100 * f);
+                test_size<Benchmark>(size, reps, distribution, flush_cache);
+            }
+        }
+    });
 
     return 0;
 }
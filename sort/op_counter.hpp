@@ -0,0 +1,136 @@
+/*******************************************************************************
+ * sort/op_counter.hpp
+ *
+ * Thread-local counters of element operations (comparisons, copies, moves,
+ * assignments and swaps), aggregated across all threads which used them.
+ * Counting is compiled in only with MBM_COUNT_OPERATIONS=1.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_OP_COUNTER_HEADER
+#define MBM_SORT_OP_COUNTER_HEADER
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+#ifndef MBM_COUNT_OPERATIONS
+#define MBM_COUNT_OPERATIONS 0
+#endif
+
+//! aggregated operation counts
+struct OpCounts {
+    uint64_t comparisons = 0, copies = 0, moves = 0, assignments = 0,
+             swaps = 0;
+
+    //! print as RESULT columns
+    friend std::ostream& operator<<(std::ostream& os, const OpCounts& c) {
+        return os << "comparisons=" << c.comparisons << '\t'
+                  << "copies=" << c.copies << '\t'
+                  << "moves=" << c.moves << '\t'
+                  << "assignments=" << c.assignments << '\t'
+                  << "swaps=" << c.swaps << '\t';
+    }
+};
+
+/*!
+ * Each thread increments only its own counters, which are relaxed atomics
+ * such that total() may read them from another thread. Counters of threads
+ * that exit, e.g. of a destroyed thread pool, are added to a retired sum.
+ */
+class OpCounter {
+public:
+    enum Op { Comparison, Copy, Move, Assignment, Swap, NumOps };
+
+    static void count(Op op) {
+        std::atomic<uint64_t>& c = local().count[op];
+        c.store(c.load(std::memory_order_relaxed) + 1,
+            std::memory_order_relaxed);
+    }
+
+    //! sum of the counters of all threads
+    static OpCounts total() {
+        Registry& r = registry();
+        std::unique_lock<std::mutex> lock(r.mutex);
+        uint64_t sum[NumOps];
+        std::copy(r.retired, r.retired + NumOps, sum);
+        for (const Local* l : r.locals) {
+            for (size_t op = 0; op < NumOps; ++op)
+                sum[op] += l->count[op].load(std::memory_order_relaxed);
+        }
+        OpCounts c;
+        c.comparisons = sum[Comparison], c.copies = sum[Copy];
+        c.moves = sum[Move], c.assignments = sum[Assignment];
+        c.swaps = sum[Swap];
+        return c;
+    }
+
+    //! zero the counters of all threads, which must not count concurrently
+    static void reset() {
+        Registry& r = registry();
+        std::unique_lock<std::mutex> lock(r.mutex);
+        std::fill(r.retired, r.retired + NumOps, 0);
+        for (Local* l : r.locals) {
+            for (size_t op = 0; op < NumOps; ++op)
+                l->count[op].store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct Local;
+
+    struct Registry {
+        std::mutex mutex;
+        std::vector<Local*> locals;
+        uint64_t retired[NumOps] = {};
+    };
+
+    static Registry& registry() {
+        static Registry r;
+        return r;
+    }
+
+    //! counters of one thread, registered while the thread lives
+    struct Local {
+        std::atomic<uint64_t> count[NumOps];
+
+        Local() {
+            for (size_t op = 0; op < NumOps; ++op)
+                count[op].store(0, std::memory_order_relaxed);
+            Registry& r = registry();
+            std::unique_lock<std::mutex> lock(r.mutex);
+            r.locals.push_back(this);
+        }
+        ~Local() {
+            Registry& r = registry();
+            std::unique_lock<std::mutex> lock(r.mutex);
+            for (size_t op = 0; op < NumOps; ++op)
+                r.retired[op] += count[op].load(std::memory_order_relaxed);
+            r.locals.erase(std::find(r.locals.begin(), r.locals.end(), this));
+        }
+    };
+
+    static Local& local() {
+        thread_local Local l;
+        return l;
+    }
+};
+
+//! count an operation if counting is compiled in
+static inline void count_operation(OpCounter::Op op) {
+#if MBM_COUNT_OPERATIONS
+    OpCounter::count(op);
+#else
+    (void)op;
+#endif
+}
+
+#endif // !MBM_SORT_OP_COUNTER_HEADER
+
+/******************************************************************************/
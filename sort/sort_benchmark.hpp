@@ -0,0 +1,460 @@
+/*******************************************************************************
+ * sort/sort_benchmark.hpp
+ *
+ * Common input setup, selection and measurement for the sort benchmarks.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_SORT_BENCHMARK_HEADER
+#define MBM_SORT_SORT_BENCHMARK_HEADER
+
+#include <microbenchmarking.hpp>
+
+#include "input_distributions.hpp"
+#include "sort_items.hpp"
+
+#include <tlx/container/simple_vector.hpp>
+#include <tlx/die.hpp>
+#include <tlx/timestamp.hpp>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/******************************************************************************/
+// Peak Memory
+
+//! a "<field>: <n> kB" line of /proc/self/status in bytes, 0 if missing
+static inline size_t proc_status_bytes(const char* field) {
+    FILE* f = fopen("/proc/self/status", "r");
+    if (!f)
+        return 0;
+    char line[256];
+    size_t kb = 0, len = strlen(field);
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, field, len) == 0 && line[len] == ':') {
+            kb = strtoull(line + len + 1, nullptr, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return kb * 1024;
+}
+
+/*!
+ * Growth of the peak resident set during a section: start() resets the
+ * kernel's high water mark by writing 5 to /proc/self/clear_refs and records
+ * the current resident set, stop() returns how far the peak rose above it.
+ * Without clear_refs, e.g. on kernels before 4.0, stop() returns 0.
+ */
+class PeakMemory {
+public:
+    void start() {
+        FILE* f = fopen("/proc/self/clear_refs", "w");
+        supported_ = f && fputs("5", f) >= 0;
+        if (f && fclose(f) != 0)
+            supported_ = false;
+        rss_ = proc_status_bytes("VmRSS");
+    }
+    size_t stop() const {
+        if (!supported_)
+            return 0;
+        size_t hwm = proc_status_bytes("VmHWM");
+        return hwm > rss_ ? hwm - rss_ : 0;
+    }
+
+private:
+    bool supported_ = false;
+    size_t rss_ = 0;
+};
+
+/******************************************************************************/
+// Parallel Verification
+
+//! hash of all bytes of an item, key and payload, mixed in words of eight.
+//! The item types have no padding bytes.
+template <typename Item>
+uint64_t item_hash(const Item& item) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&item);
+    uint64_t h = 0;
+    for (size_t i = 0; i < sizeof(Item); i += 8) {
+        uint64_t word = 0;
+        memcpy(&word, bytes + i, std::min<size_t>(8, sizeof(Item) - i));
+        h = SplitMix64::mix(h ^ word);
+    }
+    return h;
+}
+
+//! order-independent fingerprint of the multiset of items[0,n)
+template <typename Item>
+uint64_t fingerprint(const Item* items, size_t n) {
+    uint64_t sum = 0;
+#pragma omp parallel for reduction(+ : sum) schedule(static)
+    for (size_t i = 0; i < n; ++i)
+        sum += item_hash(items[i]);
+    return sum;
+}
+
+/*!
+ * Check in parallel that each segment [i, i + segment) of [begin,end) is
+ * sorted. Every thread checks the pairs starting in its range, including the
+ * one across the range end.
+ */
+template <typename Iterator, typename Compare>
+bool parallel_is_sorted(Iterator begin, Iterator end, Compare cmp,
+    size_t segment = size_t(-1)) {
+    const size_t n = end - begin;
+    std::atomic<bool> sorted(true);
+    parallel_ranges(n, [&](size_t range_begin, size_t range_end) {
+        for (size_t i = range_begin; i < range_end;) {
+            size_t segment_end = std::min(n, (i / segment + 1) * segment);
+            if (!std::is_sorted(begin + i,
+                    begin + std::min(range_end + 1, segment_end), cmp))
+                sorted.store(false, std::memory_order_relaxed);
+            i = std::min(range_end, segment_end);
+        }
+    });
+    return sorted.load();
+}
+
+//! items with a payload b, which holds the input position for a stability
+//! check
+template <typename Item, typename = void>
+struct HasPositionPayload : std::false_type { };
+
+template <typename Item>
+struct HasPositionPayload<Item, decltype(void(std::declval<Item&>().b = 0))>
+    : std::true_type { };
+
+/******************************************************************************/
+
+template <typename Item>
+class SortBenchmark {
+public:
+    using Traits = ItemTraits<Item>;
+
+    //! uninitialized array, the pages are first touched by the parallel input
+    //! generation threads instead of the main thread.
+    using Array = tlx::SimpleVector<Item, tlx::SimpleVectorMode::NoInitNoDestroy>;
+    using Iterator = typename Array::iterator;
+
+    //! long-lived buffer, refilled for every repetition
+    Array vec_;
+    std::less<Item> cmp_;
+    Distribution distribution_;
+
+    //! largest range the sorter handles, longer arrays are sorted in segments
+    static const size_t max_sort_size = size_t(-1);
+
+    //! count branch misses instead of L1 instruction cache misses
+    static const bool count_branch_misses = false;
+
+    //! count data TLB misses instead of L1 instruction cache misses
+    static const bool count_dtlb_misses = false;
+
+    //! whether the sorter is stable, which test_benchmark() then checks on
+    //! items with a position payload
+    static const bool stable = false;
+
+    //! multiset fingerprint of the input, computed by reset() and again by
+    //! test_benchmark() after set_positions()
+    uint64_t fingerprint_ = 0;
+
+    //! vec_ is sorted as independent segments of this size, set by test_size()
+    size_t segment_;
+
+    //! time and cycles of the last run() per item, set by test_size()
+    double ns_per_item_ = 0;
+    double cycles_per_item_ = 0;
+
+    //! element operations of the last run() if the item counts them
+    OpCounts op_counts_;
+
+    //! additional storage of the items, e.g. records pointed to
+    typename Traits::Storage storage_;
+
+    //! scratch memory allocated by the sorter outside of run()
+    size_t scratch_bytes_ = 0;
+    //! time to allocate and first-touch the scratch memory
+    double scratch_time_ = 0;
+    //! time of the last check()
+    double check_time_ = 0;
+    //! growth of the peak resident set during the last run()
+    size_t run_peak_bytes_ = 0;
+
+    SortBenchmark(size_t size, Distribution distribution)
+        : vec_(size), distribution_(distribution), segment_(size) {
+    }
+
+    //! regenerate the input of repetition rep into the same buffer, one
+    //! independent input per segment
+    void reset(size_t rep) {
+        Traits::generate(storage_, distribution_, vec_.data(), vec_.size(),
+            123456 + rep, segment_);
+        fingerprint_ = fingerprint(vec_.data(), vec_.size());
+    }
+
+    //! overwrite the payload b of the items with their input position
+    void set_positions() {
+        if constexpr (HasPositionPayload<Item>::value) {
+            const size_t n = vec_.size();
+#pragma omp parallel for schedule(static)
+            for (size_t i = 0; i < n; ++i)
+                vec_[i].b = static_cast<decltype(vec_[i].b)>(i);
+        }
+    }
+
+    //! allocate and first-touch a scratch array of the sorter once, such that
+    //! repetitions reuse it and run() measures no allocation.
+    template <typename Type>
+    void allocate_scratch(
+        tlx::SimpleVector<Type, tlx::SimpleVectorMode::NoInitNoDestroy>& array,
+        size_t size) {
+        double ts1 = tlx::timestamp();
+        array.resize(size);
+        parallel_memset(array.data(), 0, size * sizeof(Type));
+        scratch_time_ += tlx::timestamp() - ts1;
+        scratch_bytes_ += size * sizeof(Type);
+    }
+
+    //! call func(begin, end) for each segment of vec_
+    template <typename Func>
+    void for_each_segment(Func func) {
+        for (size_t i = 0; i < vec_.size(); i += segment_) {
+            func(vec_.begin() + i,
+                vec_.begin() + std::min(i + segment_, vec_.size()));
+        }
+    }
+
+    //! check that each segment is sorted and vec_ is a permutation of the
+    //! input
+    void check() {
+        die_unless(
+            parallel_is_sorted(vec_.begin(), vec_.end(), cmp_, segment_));
+        die_unless(fingerprint(vec_.data(), vec_.size()) == fingerprint_);
+    }
+
+    //! check that equal items kept the input order of set_positions()
+    void check_stable() {
+        if constexpr (HasPositionPayload<Item>::value) {
+            const size_t n = vec_.size();
+            std::atomic<bool> stable(true);
+            parallel_ranges(n, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end && i + 1 < n; ++i) {
+                    if ((i + 1) % segment_ != 0 &&
+                        !cmp_(vec_[i], vec_[i + 1]) &&
+                        vec_[i].b > vec_[i + 1].b)
+                        stable.store(false, std::memory_order_relaxed);
+                }
+            });
+            die_unless(stable.load());
+        }
+    }
+
+    virtual const char* name() const = 0;
+
+    friend std::ostream& operator<<(std::ostream& os, const SortBenchmark& b) {
+        os << "benchmark=" << b.name() << '\t'
+           << "item=" << Traits::name() << '\t'
+           << "item_size=" << sizeof(Item) << '\t'
+           << "distribution=" << distribution_name(b.distribution_)
+           << '\t' << "size=" << b.vec_.size() << '\t'
+           << "segment=" << b.segment_ << '\t'
+           << "scratch_bytes=" << b.scratch_bytes_ << '\t'
+           << "scratch_time=" << b.scratch_time_ << '\t'
+           << "peak_extra_bytes=" << b.scratch_bytes_ + b.run_peak_bytes_
+           << '\t'
+           << "check_time=" << b.check_time_ << '\t'
+           << "ns_per_item=" << b.ns_per_item_ << '\t'
+           << "cycles_per_item=" << b.cycles_per_item_ << '\t';
+        if (Traits::counted)
+            os << b.op_counts_;
+        return os;
+    }
+};
+
+/******************************************************************************/
+// Item Type and Distribution Selection
+
+template <typename Type>
+struct ItemTag {
+    using type = Type;
+};
+
+//! call func(ItemTag<Item>()) for all item types
+template <typename Func>
+void for_each_item_type(Func func) {
+    func(ItemTag<MyStruct>());
+#if MBM_COUNT_OPERATIONS
+    func(ItemTag<CountedStruct>());
+#endif
+    func(ItemTag<Record<uint64_t, 8>>());
+    func(ItemTag<Record<uint64_t, 16>>());
+    func(ItemTag<Record<uint64_t, 32>>());
+    func(ItemTag<Record<uint64_t, 64>>());
+    func(ItemTag<Record<uint64_t, 128>>());
+    func(ItemTag<KeyIndex>());
+    func(ItemTag<FloatKey<float, uint32_t>>());
+    func(ItemTag<FloatKey<double, uint64_t>>());
+    func(ItemTag<IndirectRecord>());
+    func(ItemTag<DictStruct>());
+    func(ItemTag<StringItem>());
+    func(ItemTag<CostlyStruct<8>>());
+    func(ItemTag<CostlyStruct<64>>());
+}
+
+//! distributions and item types selected on the command line, all if none.
+//! The keyword "small" selects the small-size sweep of mbm_sort.
+class SortSelection {
+public:
+    std::vector<Distribution> distributions_;
+    std::vector<std::string> items_;
+    bool small_ = false;
+
+    SortSelection(int argc, char* argv[]) {
+        for (int i = 1; i < argc; ++i) {
+            if (strcmp(argv[i], "small") == 0) {
+                small_ = true;
+                continue;
+            }
+            Distribution d;
+            if (parse_distribution(argv[i], &d)) {
+                distributions_.push_back(d);
+                continue;
+            }
+            bool found = false;
+            for_each_item_type([&](auto tag) {
+                using Item = typename decltype(tag)::type;
+                if (strcmp(argv[i], ItemTraits<Item>::name()) == 0)
+                    found = true;
+            });
+            if (!found)
+                die("Unknown distribution or item type " << argv[i]);
+            items_.push_back(argv[i]);
+        }
+        if (distributions_.empty()) {
+            distributions_.assign(
+                std::begin(all_distributions), std::end(all_distributions));
+        }
+    }
+
+    bool item_selected(const char* name) const {
+        return items_.empty() ||
+               std::find(items_.begin(), items_.end(), name) != items_.end();
+    }
+
+    //! call func(ItemTag<Item>()) for all selected item types
+    template <typename Func>
+    void for_each_item(Func func) const {
+        for_each_item_type([&](auto tag) {
+            using Item = typename decltype(tag)::type;
+            if (item_selected(ItemTraits<Item>::name()))
+                func(tag);
+        });
+    }
+};
+
+/******************************************************************************/
+
+//! evict the CPU caches by writing a buffer larger than the last level cache
+static inline void flush_cpu_caches() {
+    static std::vector<char> buffer;
+    static char round = 0;
+    if (buffer.empty()) {
+        long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+        buffer.resize(std::max<long>(4 * llc, 64 * 1024 * 1024));
+    }
+    parallel_memset(buffer.data(), ++round, buffer.size());
+}
+
+/*!
+ * Run repetitions [0,reps) of an already constructed sorter on one size. The
+ * benchmark object and its buffers live for all repetitions, the input is
+ * regenerated in place.
+ */
+template <typename Benchmark>
+void test_benchmark(Benchmark& benchmark, size_t reps,
+    bool flush_cache = false) {
+
+    Microbenchmark mbm;
+    mbm.enable_hw_cpu_cycles();
+    mbm.enable_hw_instructions();
+    mbm.enable_hw_ref_cpu_cycles();
+
+    if (Benchmark::count_branch_misses) {
+        mbm.enable_hw_branch_misses();
+    }
+    else if (Benchmark::count_dtlb_misses) {
+        mbm.enable_hw_cache1(
+            PerfCache::DTLB, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+    }
+    else {
+        mbm.enable_hw_cache1(
+            PerfCache::L1I, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+    }
+    mbm.enable_hw_cache2(
+        PerfCache::L1D, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+    mbm.enable_hw_cache3(
+        PerfCache::LL, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+
+    const size_t size = benchmark.vec_.size();
+
+    for (size_t rep = 0; rep < reps; ++rep) {
+        benchmark.reset(rep);
+        if (Benchmark::stable) {
+            benchmark.set_positions();
+            benchmark.fingerprint_ =
+                fingerprint(benchmark.vec_.data(), size);
+        }
+        if (flush_cache)
+            flush_cpu_caches();
+        if (Benchmark::Traits::counted)
+            OpCounter::reset();
+        PeakMemory peak;
+        peak.start();
+        mbm.run(benchmark);
+        benchmark.run_peak_bytes_ = peak.stop();
+        if (Benchmark::Traits::counted)
+            benchmark.op_counts_ = OpCounter::total();
+        double ts1 = tlx::timestamp();
+        benchmark.check();
+        if (Benchmark::stable)
+            benchmark.check_stable();
+        benchmark.check_time_ = tlx::timestamp() - ts1;
+        benchmark.ns_per_item_ = mbm.time() * 1e9 / size;
+        uint64_t cycles = mbm.hw_cpu_cycles();
+        benchmark.cycles_per_item_ =
+            cycles == uint64_t(-1) ? 0 : static_cast<double>(cycles) / size;
+        mbm.print(benchmark);
+    }
+}
+
+/*!
+ * Run repetitions [0,reps) of a sorter on one size. If segment is given, or
+ * the sorter has a smaller max_sort_size, the array is a batch of independent
+ * segments sorted one after another.
+ */
+template <typename Benchmark>
+void test_size(size_t size, size_t reps, Distribution distribution,
+    bool flush_cache = false, size_t segment = 0) {
+    Benchmark benchmark(size, distribution);
+    benchmark.segment_ = std::min(segment ? segment : size,
+        static_cast<size_t>(Benchmark::max_sort_size));
+    test_benchmark(benchmark, reps, flush_cache);
+}
+
+#endif // !MBM_SORT_SORT_BENCHMARK_HEADER
+
+/******************************************************************************/
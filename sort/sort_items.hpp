@@ -0,0 +1,599 @@
+/*******************************************************************************
+ * sort/sort_items.hpp
+ *
+ * Item types for the sort benchmarks and their traits: key widths, record
+ * sizes, (key, index) pairs, floating point keys, pointers to records, and
+ * items whose comparisons are expensive.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_SORT_ITEMS_HEADER
+#define MBM_SORT_SORT_ITEMS_HEADER
+
+#include "input_cache.hpp"
+#include "input_distributions.hpp"
+#include "op_counter.hpp"
+
+#include <tlx/container/simple_vector.hpp>
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+/******************************************************************************/
+// Item Types
+
+//! 32-bit key and 32-bit payload
+struct MyStruct {
+    uint32_t a, b;
+
+    explicit MyStruct(uint32_t x = 0) : a(x), b(x * x) {
+    }
+
+    bool operator<(const MyStruct& other) const {
+        return a < other.a;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const MyStruct& s) {
+        return os << '(' << s.a << ',' << s.b << ')';
+    }
+};
+
+/*!
+ * MyStruct counting its comparisons, copy and move constructions, assignments
+ * and swaps with OpCounter. Without MBM_COUNT_OPERATIONS it is the plain
+ * trivially copyable struct.
+ */
+struct CountedStruct {
+    uint32_t a, b;
+
+    explicit CountedStruct(uint32_t x = 0) : a(x), b(x * x) {
+    }
+
+#if MBM_COUNT_OPERATIONS
+    CountedStruct(const CountedStruct& o) : a(o.a), b(o.b) {
+        count_operation(OpCounter::Copy);
+    }
+    CountedStruct(CountedStruct&& o) : a(o.a), b(o.b) {
+        count_operation(OpCounter::Move);
+    }
+    CountedStruct& operator=(const CountedStruct& o) {
+        count_operation(OpCounter::Assignment);
+        a = o.a, b = o.b;
+        return *this;
+    }
+    CountedStruct& operator=(CountedStruct&& o) {
+        count_operation(OpCounter::Assignment);
+        a = o.a, b = o.b;
+        return *this;
+    }
+    friend void swap(CountedStruct& x, CountedStruct& y) {
+        count_operation(OpCounter::Swap);
+        std::swap(x.a, y.a);
+        std::swap(x.b, y.b);
+    }
+#endif
+
+    bool operator<(const CountedStruct& other) const {
+        count_operation(OpCounter::Comparison);
+        return a < other.a;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const CountedStruct& s) {
+        return os << '(' << s.a << ',' << s.b << ')';
+    }
+};
+
+//! record of Size bytes starting with an unsigned key, the rest is payload
+template <typename Key, size_t Size>
+struct Record {
+    static_assert(Size % sizeof(Key) == 0, "Size must be a multiple of Key");
+
+    Key key;
+    std::array<Key, Size / sizeof(Key) - 1> payload;
+
+    explicit Record(Key k = 0) : key(k) {
+        for (size_t i = 0; i < payload.size(); ++i)
+            payload[i] = k + i;
+    }
+
+    bool operator<(const Record& other) const {
+        return key < other.key;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const Record& r) {
+        return os << '(' << r.key << ')';
+    }
+};
+
+//! key and its original position in the input, as used by an argsort
+struct KeyIndex {
+    uint64_t key;
+    uint64_t index;
+
+    explicit KeyIndex(uint64_t k = 0) : key(k), index(0) {
+    }
+
+    bool operator<(const KeyIndex& other) const {
+        return key < other.key;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const KeyIndex& s) {
+        return os << '(' << s.key << ',' << s.index << ')';
+    }
+};
+
+//! map IEEE float bits to unsigned integers in totalOrder: -NaN < -inf < ...
+//! < -0 < +0 < ... < +inf < +NaN.
+template <typename UInt, typename Float>
+UInt float_to_ordered(Float f) {
+    static_assert(sizeof(UInt) == sizeof(Float), "size mismatch");
+    const UInt sign = UInt(1) << (8 * sizeof(UInt) - 1);
+    UInt u;
+    memcpy(&u, &f, sizeof(u));
+    return (u & sign) ? ~u : (u ^ sign);
+}
+
+//! inverse of float_to_ordered()
+template <typename Float, typename UInt>
+Float ordered_to_float(UInt k) {
+    static_assert(sizeof(UInt) == sizeof(Float), "size mismatch");
+    const UInt sign = UInt(1) << (8 * sizeof(UInt) - 1);
+    UInt u = (k & sign) ? (k ^ sign) : ~k;
+    Float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/*!
+ * Floating point key ordered by IEEE totalOrder, which places NaNs of either
+ * sign at the ends. The input is generated by mapping the unsigned keys back
+ * to floats, hence the full key range contains infinities and NaNs.
+ */
+template <typename Float, typename UInt>
+struct FloatKey {
+    Float key;
+
+    explicit FloatKey(UInt k = 0) : key(ordered_to_float<Float>(k)) {
+    }
+
+    UInt ordered() const {
+        return float_to_ordered<UInt>(key);
+    }
+
+    bool operator<(const FloatKey& other) const {
+        return ordered() < other.ordered();
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const FloatKey& s) {
+        return os << '(' << s.key << ')';
+    }
+};
+
+//! pointer to a record on the heap, sorting compares through the pointer
+struct IndirectRecord {
+    using Target = Record<uint64_t, 64>;
+
+    const Target* ptr;
+
+    explicit IndirectRecord(const Target* p = nullptr) : ptr(p) {
+    }
+
+    bool operator<(const IndirectRecord& other) const {
+        return ptr->key < other.ptr->key;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const IndirectRecord& s) {
+        return os << *s.ptr;
+    }
+};
+
+/******************************************************************************/
+// Items with Expensive Comparisons
+
+//! bijective mixing of 32-bit keys into opaque dictionary ids (lowbias32 with
+//! an xor, such that no id is zero together with its key).
+static inline uint32_t scramble_key(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x ^ 0x9E3779B9u;
+}
+
+//! inverse of scramble_key()
+static inline uint32_t unscramble_key(uint32_t x) {
+    x ^= 0x9E3779B9u;
+    x ^= x >> 16;
+    x *= 0x43021123u;
+    x ^= (x >> 15) ^ (x >> 30);
+    x *= 0x1D69E2A5u;
+    x ^= x >> 16;
+    return x;
+}
+
+/*!
+ * Hash table with linear probing mapping 32-bit ids to 32-bit keys, filled in
+ * parallel by insert() and only read while sorting. Each slot holds id << 32
+ * | key or zero if empty, and is claimed by an atomic compare-and-swap. The
+ * ids are already mixed, hence their low bits are used as hash value.
+ */
+class KeyDictionary {
+public:
+    //! empty the table and size it for up to n distinct ids
+    void clear(size_t n) {
+        size_t size = 16;
+        while (size < 2 * n)
+            size *= 2;
+        if (slots_.size() != size)
+            slots_.resize(size);
+        mask_ = size - 1;
+        parallel_memset(slots_.data(), 0, size * sizeof(slots_[0]));
+    }
+
+    //! insert id unless already contained, called concurrently
+    void insert(uint32_t id, uint32_t key) {
+        const uint64_t entry = (uint64_t(id) << 32) | key;
+        for (size_t i = id & mask_;; i = (i + 1) & mask_) {
+            uint64_t e = __atomic_load_n(&slots_[i], __ATOMIC_RELAXED);
+            if (e == 0 && __atomic_compare_exchange_n(&slots_[i], &e, entry,
+                    false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return;
+            if ((e >> 32) == id)
+                return;
+        }
+    }
+
+    //! key of a contained id. The probe sequence reaches the id's slot before
+    //! any empty one.
+    uint32_t lookup(uint32_t id) const {
+        for (size_t i = id & mask_;; i = (i + 1) & mask_) {
+            uint64_t e = slots_[i];
+            if ((e >> 32) == id)
+                return static_cast<uint32_t>(e);
+        }
+    }
+
+private:
+    tlx::SimpleVector<uint64_t, tlx::SimpleVectorMode::NoInitNoDestroy> slots_;
+    size_t mask_ = 0;
+};
+
+/*!
+ * Opaque id and payload, ordered by the key looked up in a KeyDictionary, as
+ * when sort keys are attributes found by a dictionary lookup. Each comparison
+ * does two hash table lookups, which miss the cache for large inputs.
+ */
+struct DictStruct {
+    uint32_t id, b;
+
+    //! dictionary of the current input, set by its generation
+    static inline const KeyDictionary* dictionary = nullptr;
+
+    explicit DictStruct(uint32_t x = 0) : id(scramble_key(x)), b(x * x) {
+    }
+
+    uint32_t key() const {
+        return dictionary->lookup(id);
+    }
+
+    bool operator<(const DictStruct& other) const {
+        return key() < other.key();
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const DictStruct& s) {
+        return os << '(' << s.id << ',' << s.b << ')';
+    }
+};
+
+/*!
+ * Pointer to a string of a common prefix followed by the key as zero-padded
+ * decimal number, hence each comparison is a strcmp() scanning at least the
+ * prefix.
+ */
+struct StringItem {
+    //! common prefix of all strings
+    static constexpr const char* prefix = "/catalog/product/";
+    static const size_t prefix_size = 17;
+    //! zero-padded decimal digits of a 32-bit key
+    static const size_t digits = 10;
+    //! bytes reserved per string including the terminator, a power of two
+    static const size_t stride = 32;
+
+    const char* str;
+
+    explicit StringItem(const char* s = nullptr) : str(s) {
+    }
+
+    //! write the string of key to out[0,stride)
+    static void write(char* out, uint32_t key) {
+        memcpy(out, prefix, prefix_size);
+        for (size_t i = digits; i > 0; --i, key /= 10)
+            out[prefix_size + i - 1] = static_cast<char>('0' + key % 10);
+        out[prefix_size + digits] = 0;
+    }
+
+    //! parse the key back from the digits
+    uint32_t key() const {
+        uint32_t k = 0;
+        for (size_t i = 0; i < digits; ++i)
+            k = 10 * k + static_cast<uint32_t>(str[prefix_size + i] - '0');
+        return k;
+    }
+
+    bool operator<(const StringItem& other) const {
+        return strcmp(str, other.str) < 0;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const StringItem& s) {
+        return os << '(' << s.str << ')';
+    }
+};
+
+/*!
+ * MyStruct whose key is computed by Cost dependent multiplications by an
+ * opaque one, which the compiler can neither elide nor reorder. Comparisons
+ * and key extraction for radix sorters pay the same synthetic cost per key.
+ */
+template <size_t Cost>
+struct CostlyStruct {
+    uint32_t a, b;
+
+    explicit CostlyStruct(uint32_t x = 0) : a(x), b(x * x) {
+    }
+
+    uint32_t key() const {
+        uint64_t k = a, one = 1;
+        asm("" : "+r"(one));
+        for (size_t i = 0; i < Cost; ++i) {
+            k *= one;
+            asm("" : "+r"(k));
+        }
+        return static_cast<uint32_t>(k);
+    }
+
+    bool operator<(const CostlyStruct& other) const {
+        return key() < other.key();
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const CostlyStruct& s) {
+        return os << '(' << s.a << ',' << s.b << ')';
+    }
+};
+
+/******************************************************************************/
+// Item Traits
+
+/*!
+ * ItemTraits<Item> provide the RESULT name of the item type, the unsigned Key
+ * type used to generate the input, the order-preserving unsigned key used by
+ * the radix sorters, generate() to fill an array of items or a batch of
+ * independent inputs of segment items, the bytes of storage generate()
+ * allocates per item, and whether the item counts its operations.
+ */
+template <typename Item>
+struct ItemTraits;
+
+//! traits of items constructed directly from generated keys
+template <typename Item, typename Key_>
+struct DirectItemTraits {
+    using Key = Key_;
+
+    static const bool counted = false;
+
+    //! no storage besides the array of items
+    struct Storage { };
+
+    static const size_t storage_bytes_per_item = 0;
+
+    static void generate(Storage&, Distribution d, Item* out, size_t n,
+        uint64_t seed, size_t segment = size_t(-1)) {
+        // only trivially copyable items can be cached as raw bytes
+        if constexpr (std::is_trivially_copyable<Item>::value) {
+            generate_input_cached<Key>(
+                d, out, n, seed, ItemTraits<Item>::name(), segment);
+        }
+        else {
+            generate_input<Key>(d, out, n, seed, segment);
+        }
+    }
+};
+
+template <>
+struct ItemTraits<MyStruct> : DirectItemTraits<MyStruct, uint32_t> {
+    static const char* name() {
+        return "u32_8B";
+    }
+    static uint32_t key(const MyStruct& s) {
+        return s.a;
+    }
+};
+
+template <>
+struct ItemTraits<CountedStruct> : DirectItemTraits<CountedStruct, uint32_t> {
+    static const bool counted = MBM_COUNT_OPERATIONS;
+
+    static const char* name() {
+        return "u32_8B_counted";
+    }
+    static uint32_t key(const CountedStruct& s) {
+        return s.a;
+    }
+};
+
+template <size_t Size>
+struct ItemTraits<Record<uint64_t, Size>>
+    : DirectItemTraits<Record<uint64_t, Size>, uint64_t> {
+    static const char* name() {
+        static const std::string name = "u64_" + std::to_string(Size) + "B";
+        return name.c_str();
+    }
+    static uint64_t key(const Record<uint64_t, Size>& r) {
+        return r.key;
+    }
+};
+
+template <>
+struct ItemTraits<KeyIndex> : DirectItemTraits<KeyIndex, uint64_t> {
+    static const char* name() {
+        return "u64_index";
+    }
+    static uint64_t key(const KeyIndex& s) {
+        return s.key;
+    }
+    static void generate(Storage& storage, Distribution d, KeyIndex* out,
+        size_t n, uint64_t seed, size_t segment = size_t(-1)) {
+        DirectItemTraits::generate(storage, d, out, n, seed, segment);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i)
+            out[i].index = i;
+    }
+};
+
+template <>
+struct ItemTraits<FloatKey<float, uint32_t>>
+    : DirectItemTraits<FloatKey<float, uint32_t>, uint32_t> {
+    static const char* name() {
+        return "f32";
+    }
+    static uint32_t key(const FloatKey<float, uint32_t>& s) {
+        return s.ordered();
+    }
+};
+
+template <>
+struct ItemTraits<FloatKey<double, uint64_t>>
+    : DirectItemTraits<FloatKey<double, uint64_t>, uint64_t> {
+    static const char* name() {
+        return "f64";
+    }
+    static uint64_t key(const FloatKey<double, uint64_t>& s) {
+        return s.ordered();
+    }
+};
+
+template <>
+struct ItemTraits<IndirectRecord> {
+    using Key = uint64_t;
+
+    static const bool counted = false;
+
+    //! the records pointed to, generated like direct items
+    using Storage = tlx::SimpleVector<IndirectRecord::Target,
+        tlx::SimpleVectorMode::NoInitNoDestroy>;
+
+    static const size_t storage_bytes_per_item = sizeof(IndirectRecord::Target);
+
+    static const char* name() {
+        return "ptr_u64_64B";
+    }
+    static uint64_t key(const IndirectRecord& s) {
+        return s.ptr->key;
+    }
+    static void generate(Storage& records, Distribution d, IndirectRecord* out,
+        size_t n, uint64_t seed, size_t segment = size_t(-1)) {
+        if (records.size() != n)
+            records.resize(n);
+        ItemTraits<IndirectRecord::Target>::Storage none;
+        ItemTraits<IndirectRecord::Target>::generate(
+            none, d, records.data(), n, seed, segment);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i)
+            out[i] = IndirectRecord(&records[i]);
+    }
+};
+
+template <>
+struct ItemTraits<DictStruct> : DirectItemTraits<DictStruct, uint32_t> {
+    using Storage = KeyDictionary;
+
+    //! the table has less than four slots per item
+    static const size_t storage_bytes_per_item = 4 * sizeof(uint64_t);
+
+    static const char* name() {
+        return "u32_dict";
+    }
+    static uint32_t key(const DictStruct& s) {
+        return s.key();
+    }
+    static void generate(KeyDictionary& dictionary, Distribution d,
+        DictStruct* out, size_t n, uint64_t seed,
+        size_t segment = size_t(-1)) {
+        DirectItemTraits::Storage none;
+        DirectItemTraits::generate(none, d, out, n, seed, segment);
+        dictionary.clear(n);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i)
+            dictionary.insert(out[i].id, unscramble_key(out[i].id));
+        DictStruct::dictionary = &dictionary;
+    }
+};
+
+template <>
+struct ItemTraits<StringItem> {
+    using Key = uint32_t;
+
+    static const bool counted = false;
+
+    //! the characters of the strings and their keys
+    struct Storage {
+        tlx::SimpleVector<char, tlx::SimpleVectorMode::NoInitNoDestroy> chars;
+        tlx::SimpleVector<uint32_t, tlx::SimpleVectorMode::NoInitNoDestroy>
+        keys;
+    };
+
+    static const size_t storage_bytes_per_item =
+        StringItem::stride + sizeof(uint32_t);
+
+    static const char* name() {
+        return "str_u32";
+    }
+    static uint32_t key(const StringItem& s) {
+        return s.key();
+    }
+    static void generate(Storage& storage, Distribution d, StringItem* out,
+        size_t n, uint64_t seed, size_t segment = size_t(-1)) {
+        if (storage.keys.size() != n) {
+            storage.keys.resize(n);
+            storage.chars.resize(n * StringItem::stride);
+        }
+        generate_input_cached<uint32_t>(
+            d, storage.keys.data(), n, seed, name(), segment);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i) {
+            char* str = storage.chars.data() + i * StringItem::stride;
+            StringItem::write(str, storage.keys[i]);
+            out[i] = StringItem(str);
+        }
+    }
+};
+
+template <size_t Cost>
+struct ItemTraits<CostlyStruct<Cost>>
+    : DirectItemTraits<CostlyStruct<Cost>, uint32_t> {
+    static const char* name() {
+        static const std::string name = "u32_cost" + std::to_string(Cost);
+        return name.c_str();
+    }
+    static uint32_t key(const CostlyStruct<Cost>& s) {
+        return s.key();
+    }
+};
+
+//! bytes of one item including its storage, for limiting the input sizes
+template <typename Item>
+constexpr size_t item_bytes() {
+    return sizeof(Item) + ItemTraits<Item>::storage_bytes_per_item;
+}
+
+#endif // !MBM_SORT_SORT_ITEMS_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,176 @@
+/*******************************************************************************
+ * sort/thread_control.hpp
+ *
+ * Thread counts and placements for scaling sweeps of the parallel sorters:
+ * the CPU topology of the process, the CPUs of p threads placed on distinct
+ * cores or packed onto SMT siblings, and pinning of all threads of the
+ * process, including already running pool threads, to these CPUs.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_THREAD_CONTROL_HEADER
+#define MBM_SORT_THREAD_CONTROL_HEADER
+
+#include <tlx/die.hpp>
+
+#include <dirent.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+/*!
+ * CPUs the process may run on, grouped by physical core as read from
+ * /sys/devices/system/cpu/cpu<i>/topology. CPUs without topology information
+ * are cores of their own.
+ */
+class CpuTopology {
+public:
+    //! logical CPUs of each core, in order of package and core id
+    std::vector<std::vector<int>> cores_;
+
+    CpuTopology() {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        die_unless(sched_getaffinity(0, sizeof(set), &set) == 0);
+
+        std::map<std::pair<int, int>, std::vector<int>> cores;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &set))
+                continue;
+            int package = read_topology(cpu, "physical_package_id");
+            int core = read_topology(cpu, "core_id");
+            if (package < 0 || core < 0)
+                package = -1, core = cpu;
+            cores[std::make_pair(package, core)].push_back(cpu);
+        }
+        for (auto& c : cores)
+            cores_.push_back(std::move(c.second));
+    }
+
+    size_t num_cores() const {
+        return cores_.size();
+    }
+
+    size_t num_cpus() const {
+        size_t n = 0;
+        for (const std::vector<int>& c : cores_)
+            n += c.size();
+        return n;
+    }
+
+    //! whether some core has more than one logical CPU
+    bool has_smt() const {
+        return num_cpus() > num_cores();
+    }
+
+    /*!
+     * CPUs for threads threads: with smt the SMT siblings of each core are
+     * filled before the next core is used, without one CPU per core is used,
+     * which requires threads <= num_cores().
+     */
+    std::vector<int> select(size_t threads, bool smt) const {
+        std::vector<int> cpus;
+        if (smt) {
+            for (const std::vector<int>& c : cores_)
+                cpus.insert(cpus.end(), c.begin(), c.end());
+        }
+        else {
+            for (const std::vector<int>& c : cores_)
+                cpus.push_back(c.front());
+        }
+        die_unless(threads <= cpus.size());
+        cpus.resize(threads);
+        return cpus;
+    }
+
+private:
+    static int read_topology(int cpu, const char* file) {
+        std::string path = "/sys/devices/system/cpu/cpu" +
+                           std::to_string(cpu) + "/topology/" + file;
+        FILE* f = fopen(path.c_str(), "r");
+        if (!f)
+            return -1;
+        int value = -1;
+        if (fscanf(f, "%d", &value) != 1)
+            value = -1;
+        fclose(f);
+        return value;
+    }
+};
+
+//! number of threads and their placement
+struct ThreadConfig {
+    size_t threads;
+    //! packed onto SMT siblings instead of distinct cores
+    bool smt;
+};
+
+/*!
+ * Thread counts 1, 2, 4, ... up to the number of CPUs, and the numbers of
+ * cores and CPUs themselves, each on distinct cores if there are enough and
+ * packed onto SMT siblings if the CPUs have any.
+ */
+static inline std::vector<ThreadConfig> thread_sweep(const CpuTopology& topo) {
+    std::vector<size_t> counts;
+    for (size_t p = 1; p <= topo.num_cpus(); p *= 2)
+        counts.push_back(p);
+    counts.push_back(topo.num_cores());
+    counts.push_back(topo.num_cpus());
+    std::sort(counts.begin(), counts.end());
+    counts.erase(std::unique(counts.begin(), counts.end()), counts.end());
+
+    std::vector<ThreadConfig> configs;
+    for (size_t p : counts) {
+        if (p <= topo.num_cores())
+            configs.push_back(ThreadConfig { p, false });
+        if (topo.has_smt() && p >= 2)
+            configs.push_back(ThreadConfig { p, true });
+    }
+    return configs;
+}
+
+//! restrict all running threads of the process to cpus, threads started
+//! later inherit the mask from their creator.
+static inline void set_process_affinity(const std::vector<int>& cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+        CPU_SET(cpu, &set);
+
+    DIR* dir = opendir("/proc/self/task");
+    die_unless(dir);
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.')
+            continue;
+        pid_t tid = static_cast<pid_t>(atoi(entry->d_name));
+        // threads may exit while iterating
+        sched_setaffinity(tid, sizeof(set), &set);
+    }
+    closedir(dir);
+}
+
+//! pin the process to the CPUs of config and set the OpenMP thread count
+static inline void apply_thread_config(
+    const CpuTopology& topo, const ThreadConfig& config) {
+    set_process_affinity(topo.select(config.threads, config.smt));
+#if defined(_OPENMP)
+    omp_set_num_threads(static_cast<int>(config.threads));
+#endif
+}
+
+#endif // !MBM_SORT_THREAD_CONTROL_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,596 @@
+/*******************************************************************************
+ * sort_external/extra/external_sort.hpp
+ *
+ * External memory sort of a file of trivially copyable items: runs of half the
+ * memory budget are read, sorted by a pluggable in-memory sorter and written
+ * to a temporary file, while the previous run is written and the next one is
+ * read. The runs are then merged in one pass with a loser tree, reading each
+ * run through two prefetched blocks and writing two output blocks
+ * alternately. All I/O requests are pread/pwrite calls executed by a pool of
+ * I/O threads, optionally with O_DIRECT bypassing the page cache. Otherwise
+ * written files are evicted from the page cache, such that the disk is used.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_EXTERNAL_EXTRA_EXTERNAL_SORT_HEADER
+#define MBM_SORT_EXTERNAL_EXTRA_EXTERNAL_SORT_HEADER
+
+#include <tlx/container/loser_tree.hpp>
+#include <tlx/die.hpp>
+#include <tlx/timestamp.hpp>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace external_sort {
+
+//! alignment of buffers, file offsets and request sizes required by O_DIRECT
+static const size_t io_alignment = 4096;
+
+static inline size_t round_up(size_t x, size_t align) {
+    return (x + align - 1) / align * align;
+}
+
+static inline size_t round_down(size_t x, size_t align) {
+    return x / align * align;
+}
+
+/******************************************************************************/
+// Buffers and Files
+
+//! uninitialized buffer aligned for O_DIRECT
+class AlignedBuffer {
+public:
+    AlignedBuffer() = default;
+
+    explicit AlignedBuffer(size_t size) {
+        resize(size);
+    }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    AlignedBuffer(AlignedBuffer&& b) noexcept
+        : data_(b.data_), size_(b.size_) {
+        b.data_ = nullptr, b.size_ = 0;
+    }
+
+    ~AlignedBuffer() {
+        free(data_);
+    }
+
+    void resize(size_t size) {
+        free(data_);
+        data_ = nullptr, size_ = size;
+        if (size == 0)
+            return;
+        void* p;
+        die_unless(posix_memalign(&p, io_alignment, size) == 0);
+        data_ = static_cast<char*>(p);
+    }
+
+    char* data() const {
+        return data_;
+    }
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+//! file accessed with pread and pwrite, optionally opened with O_DIRECT
+class File {
+public:
+    File(const std::string& path, int flags, bool direct) : path_(path) {
+#if defined(O_DIRECT)
+        if (direct)
+            flags |= O_DIRECT;
+#else
+        die_unless(!direct);
+#endif
+        fd_ = open(path.c_str(), flags | O_CLOEXEC, 0644);
+        die_unless(fd_ >= 0 || !"open() failed");
+    }
+
+    //! create a temporary file in dir, which is removed when closed
+    static File temporary(const std::string& dir, bool direct) {
+        std::string path = dir + "/mbm_external_sort.XXXXXX";
+        int fd = mkstemp(&path[0]);
+        die_unless(fd >= 0 || !"mkstemp() failed");
+        close(fd);
+        File f(path, O_RDWR, direct);
+        unlink(path.c_str());
+        return f;
+    }
+
+    File(const File&) = delete;
+    File& operator=(const File&) = delete;
+
+    File(File&& f) noexcept : fd_(f.fd_), path_(std::move(f.path_)) {
+        f.fd_ = -1;
+    }
+
+    ~File() {
+        if (fd_ >= 0)
+            close(fd_);
+    }
+
+    //! read up to size bytes at offset, fewer only at the end of the file
+    size_t read(void* data, size_t size, uint64_t offset) const {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t r = ::pread(fd_, static_cast<char*>(data) + done,
+                size - done, offset + done);
+            if (r < 0 && errno == EINTR)
+                continue;
+            die_unless(r >= 0 || !"pread() failed");
+            if (r == 0)
+                break;
+            done += r;
+        }
+        return done;
+    }
+
+    //! write size bytes at offset
+    size_t write(const void* data, size_t size, uint64_t offset) const {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t r = ::pwrite(fd_, static_cast<const char*>(data) + done,
+                size - done, offset + done);
+            if (r < 0 && errno == EINTR)
+                continue;
+            die_unless(r > 0 || !"pwrite() failed");
+            done += r;
+        }
+        return done;
+    }
+
+    void truncate(uint64_t size) const {
+        die_unless(ftruncate(fd_, size) == 0);
+    }
+
+    //! write back the dirty pages and drop the file from the page cache
+    void evict() const {
+        die_unless(fdatasync(fd_) == 0);
+        die_unless(posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED) == 0);
+    }
+
+    uint64_t size() const {
+        struct stat st;
+        die_unless(fstat(fd_, &st) == 0);
+        return st.st_size;
+    }
+
+private:
+    int fd_ = -1;
+    std::string path_;
+};
+
+/******************************************************************************/
+// I/O Queue
+
+//! bytes transferred and time during which any request was executing
+struct IoStats {
+    uint64_t read_bytes = 0, write_bytes = 0;
+    double busy_time = 0;
+};
+
+/*!
+ * Pool of threads executing read and write requests, such that several
+ * requests are in flight and overlap with the computation of the caller.
+ */
+class IoQueue {
+public:
+    explicit IoQueue(size_t threads) {
+        for (size_t i = 0; i < std::max<size_t>(1, threads); ++i)
+            threads_.emplace_back([this]() { worker(); });
+    }
+
+    ~IoQueue() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_ = true;
+        }
+        cv_.notify_all();
+        for (std::thread& t : threads_)
+            t.join();
+    }
+
+    //! read into data, the future yields the bytes read
+    std::future<size_t> read(const File& file, void* data, size_t size,
+        uint64_t offset) {
+        return submit([&file, data, size, offset]() {
+            return file.read(data, size, offset);
+        }, /* write */ false);
+    }
+
+    //! write from data, the future yields the bytes written
+    std::future<size_t> write(const File& file, const void* data, size_t size,
+        uint64_t offset) {
+        return submit([&file, data, size, offset]() {
+            return file.write(data, size, offset);
+        }, /* write */ true);
+    }
+
+    IoStats stats() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+    void reset_stats() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stats_ = IoStats();
+    }
+
+private:
+    struct Request {
+        std::function<size_t()> job;
+        std::promise<size_t> done;
+        bool write;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Request> queue_;
+    std::vector<std::thread> threads_;
+    bool done_ = false;
+
+    //! number of executing requests and when the first of them started
+    size_t executing_ = 0;
+    double busy_since_ = 0;
+    IoStats stats_;
+
+    template <typename Job>
+    std::future<size_t> submit(Job job, bool write) {
+        Request r { std::move(job), std::promise<size_t>(), write };
+        std::future<size_t> f = r.done.get_future();
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(r));
+        }
+        cv_.notify_one();
+        return f;
+    }
+
+    void worker() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() { return done_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            Request r = std::move(queue_.front());
+            queue_.pop_front();
+            if (executing_++ == 0)
+                busy_since_ = tlx::timestamp();
+            lock.unlock();
+
+            size_t bytes = r.job();
+
+            lock.lock();
+            (r.write ? stats_.write_bytes : stats_.read_bytes) += bytes;
+            if (--executing_ == 0)
+                stats_.busy_time += tlx::timestamp() - busy_since_;
+            r.done.set_value(bytes);
+        }
+    }
+};
+
+/******************************************************************************/
+// External Sorter
+
+struct Config {
+    //! main memory for the run and block buffers, excluding the scratch
+    //! memory of the run sorter
+    size_t memory = size_t(1) << 30;
+    //! largest I/O request
+    size_t block_size = size_t(8) << 20;
+    //! number of I/O threads, hence of requests in flight
+    size_t io_threads = 4;
+    //! bypass the page cache
+    bool direct_io = false;
+    //! directory of the temporary run file
+    std::string temp_dir = ".";
+};
+
+struct Stats {
+    size_t runs = 0;
+    //! wall time of run formation and merging
+    double run_time = 0, merge_time = 0;
+    //! time the sorting thread waited for I/O requests
+    double wait_time = 0;
+    IoStats io;
+};
+
+/*!
+ * Sort a file of trivially copyable items with the in-memory run sorter
+ * run_sort(Item* begin, Item* end) and the comparator cmp. The number of runs
+ * is limited by the memory needed for two blocks per run.
+ */
+template <typename Item, typename RunSorter,
+          typename Compare = std::less<Item>>
+class ExternalSorter {
+    static_assert(std::is_trivially_copyable<Item>::value,
+        "items must be trivially copyable");
+    static_assert(io_alignment % sizeof(Item) == 0,
+        "item size must divide the I/O alignment");
+
+public:
+    using Futures = std::vector<std::future<size_t>>;
+
+    ExternalSorter(const Config& config, RunSorter run_sort,
+        Compare cmp = Compare())
+        : config_(config), run_sort_(run_sort), cmp_(cmp),
+          io_(config.io_threads) {
+    }
+
+    //! sort the items of the input file into the output file. With buffered
+    //! I/O the run and output files are written back and evicted, hence the
+    //! runs are read from the disk and the sort ends with its output there.
+    void sort(const std::string& input, const std::string& output) {
+        stats_ = Stats();
+        io_.reset_stats();
+
+        File in(input, O_RDONLY, config_.direct_io);
+        File runs = File::temporary(config_.temp_dir, config_.direct_io);
+        File out(output, O_RDWR | O_CREAT | O_TRUNC, config_.direct_io);
+
+        const uint64_t items = in.size() / sizeof(Item);
+
+        double ts1 = tlx::timestamp();
+        form_runs(in, runs, items);
+        double evict_time = evict(runs);
+        double ts2 = tlx::timestamp();
+        merge_runs(runs, out, items);
+        evict_time += evict(out);
+        double ts3 = tlx::timestamp();
+
+        stats_.run_time = ts2 - ts1;
+        stats_.merge_time = ts3 - ts2;
+        stats_.io = io_.stats();
+        stats_.io.busy_time += evict_time;
+    }
+
+    const Stats& stats() const {
+        return stats_;
+    }
+
+private:
+    Config config_;
+    RunSorter run_sort_;
+    Compare cmp_;
+    IoQueue io_;
+    Stats stats_;
+
+    //! bytes of one run, half the memory and a multiple of the alignment
+    size_t run_bytes() const {
+        return std::max(io_alignment,
+            round_down(config_.memory / 2, io_alignment));
+    }
+
+    //! transfer size bytes with requests of at most block_size bytes. With
+    //! O_DIRECT the size is rounded up, reads stop at the end of file.
+    template <typename Data>
+    void submit(bool write, const File& file, Data data, size_t size,
+        uint64_t offset, Futures& futures) {
+        if (config_.direct_io)
+            size = round_up(size, io_alignment);
+        const size_t block = std::max(io_alignment,
+            round_down(config_.block_size, io_alignment));
+        for (size_t i = 0; i < size; i += block) {
+            size_t n = std::min(block, size - i);
+            futures.emplace_back(write ? io_.write(file, data + i, n, offset + i)
+                                       : io_.read(file, data + i, n, offset + i));
+        }
+    }
+
+    //! evict a file after buffered I/O. The sorting thread waits for the
+    //! write back while no request executes, hence the time is I/O time.
+    double evict(const File& file) {
+        if (config_.direct_io)
+            return 0;
+        double ts = tlx::timestamp();
+        file.evict();
+        double time = tlx::timestamp() - ts;
+        stats_.wait_time += time;
+        return time;
+    }
+
+    //! wait for all requests, return bytes transferred
+    size_t wait(Futures& futures) {
+        double ts = tlx::timestamp();
+        size_t bytes = 0;
+        for (std::future<size_t>& f : futures)
+            bytes += f.get();
+        futures.clear();
+        stats_.wait_time += tlx::timestamp() - ts;
+        return bytes;
+    }
+
+    void form_runs(const File& in, const File& runs, uint64_t items) {
+        const size_t run_items = run_bytes() / sizeof(Item);
+        const size_t num_runs = (items + run_items - 1) / run_items;
+        stats_.runs = num_runs;
+
+        AlignedBuffer buffer[2] = {
+            AlignedBuffer(run_bytes()), AlignedBuffer(run_bytes())
+        };
+        Futures reads[2], writes[2];
+
+        auto run_size = [&](size_t r) {
+            return std::min<uint64_t>(run_items, items - r * run_items);
+        };
+        auto read_run = [&](size_t r, size_t b) {
+            submit(false, in, buffer[b].data(), run_size(r) * sizeof(Item),
+                r * run_bytes(), reads[b]);
+        };
+
+        if (num_runs != 0)
+            read_run(0, 0);
+
+        for (size_t r = 0; r < num_runs; ++r) {
+            size_t cur = r % 2, next = 1 - cur;
+            // read the next run once the buffer's previous run is written
+            if (r + 1 < num_runs) {
+                wait(writes[next]);
+                read_run(r + 1, next);
+            }
+            wait(reads[cur]);
+
+            Item* begin = reinterpret_cast<Item*>(buffer[cur].data());
+            run_sort_(begin, begin + run_size(r));
+
+            submit(true, runs, buffer[cur].data(), run_size(r) * sizeof(Item),
+                r * run_bytes(), writes[cur]);
+        }
+        wait(writes[0]), wait(writes[1]);
+    }
+
+    //! a sorted run read through two alternately prefetched blocks
+    struct RunReader {
+        AlignedBuffer buffer[2];
+        size_t cur = 0;
+        //! next unread byte of the run and end of the run in the file
+        uint64_t offset, end;
+        //! next and end item of the current block
+        const Item* pos = nullptr;
+        const Item* limit = nullptr;
+        //! read into the other block, empty if at the end of the run
+        Futures pending;
+        //! bytes of the run in the pending read, which may be larger with
+        //! O_DIRECT
+        size_t pending_bytes = 0;
+    };
+
+    //! read the run's next block into the other buffer
+    void prefetch(RunReader& r, const File& runs, size_t block) {
+        if (r.offset >= r.end)
+            return;
+        r.pending_bytes = std::min<uint64_t>(block, r.end - r.offset);
+        submit(false, runs, r.buffer[1 - r.cur].data(), r.pending_bytes,
+            r.offset, r.pending);
+        r.offset += r.pending_bytes;
+    }
+
+    //! switch to the prefetched block, return false at the end of the run
+    bool next_block(RunReader& r) {
+        if (r.pending.empty())
+            return false;
+        wait(r.pending);
+        r.cur = 1 - r.cur;
+        r.pos = reinterpret_cast<const Item*>(r.buffer[r.cur].data());
+        r.limit = r.pos + r.pending_bytes / sizeof(Item);
+        return true;
+    }
+
+    void merge_runs(const File& runs, const File& out, uint64_t items) {
+        const size_t k = stats_.runs;
+        if (k == 0)
+            return;
+        const size_t run_items = run_bytes() / sizeof(Item);
+
+        // two blocks per run and two output blocks
+        const size_t block = std::min(
+            round_down(config_.block_size, io_alignment),
+            round_down(config_.memory / (2 * k + 2), io_alignment));
+        if (block < io_alignment)
+            die("external_sort: too many runs (" << k << ") for the memory");
+
+        std::vector<RunReader> readers(k);
+        for (size_t r = 0; r < k; ++r) {
+            RunReader& rr = readers[r];
+            rr.buffer[0].resize(block), rr.buffer[1].resize(block);
+            rr.offset = r * run_bytes();
+            rr.end = rr.offset +
+                     std::min<uint64_t>(run_items, items - r * run_items) *
+                     sizeof(Item);
+            // load the first block, prefetch the second
+            rr.cur = 1;
+            prefetch(rr, runs, block);
+            next_block(rr);
+            prefetch(rr, runs, block);
+        }
+
+        using LoserTree = tlx::LoserTree<false, Item, Compare>;
+        LoserTree lt(static_cast<typename LoserTree::Source>(k), cmp_);
+        for (size_t r = 0; r < k; ++r)
+            lt.insert_start(readers[r].pos, r, false);
+        lt.init();
+
+        AlignedBuffer out_buffer[2] = {
+            AlignedBuffer(block), AlignedBuffer(block)
+        };
+        Futures writes[2];
+        size_t out_cur = 0;
+        Item* out_begin = reinterpret_cast<Item*>(out_buffer[0].data());
+        Item* out_pos = out_begin;
+        Item* out_limit = out_begin + block / sizeof(Item);
+        uint64_t out_offset = 0;
+
+        auto flush = [&]() {
+            size_t bytes = (out_pos - out_begin) * sizeof(Item);
+            submit(true, out, out_buffer[out_cur].data(), bytes, out_offset,
+                writes[out_cur]);
+            out_offset += bytes;
+            out_cur = 1 - out_cur;
+            wait(writes[out_cur]);
+            out_begin = reinterpret_cast<Item*>(out_buffer[out_cur].data());
+            out_pos = out_begin;
+            out_limit = out_begin + block / sizeof(Item);
+        };
+
+        for (uint64_t i = 0; i < items; ++i) {
+            RunReader& rr = readers[lt.min_source()];
+            *out_pos++ = *rr.pos++;
+            if (out_pos == out_limit)
+                flush();
+
+            if (rr.pos != rr.limit) {
+                lt.delete_min_insert(rr.pos, false);
+                continue;
+            }
+            if (!next_block(rr)) {
+                lt.delete_min_insert(nullptr, true);
+                continue;
+            }
+            // refill the finished block only after the tree dropped the
+            // pointer to its last item
+            lt.delete_min_insert(rr.pos, false);
+            prefetch(rr, runs, block);
+        }
+
+        if (out_pos != out_begin)
+            flush();
+        wait(writes[0]), wait(writes[1]);
+        // remove the padding of O_DIRECT writes
+        out.truncate(items * sizeof(Item));
+    }
+};
+
+} // namespace external_sort
+
+#endif // !MBM_SORT_EXTERNAL_EXTRA_EXTERNAL_SORT_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,293 @@
+/*******************************************************************************
+ * mbm_sort_external.cpp
+ *
+ * Microbenchmark external memory sorting of files larger than the memory
+ * budget, with different in-memory sorters for run formation.
+ *
+ * Options on the command line, besides distributions and item types:
+ *   size=<items>     sort only this number of items
+ *   memory=<bytes>   memory budget for runs and blocks, e.g. memory=4Gi
+ *   block=<bytes>    largest I/O request
+ *   io_threads=<n>   number of I/O threads
+ *   dir=<path>       directory of the input, output and run files
+ *   direct           use O_DIRECT, bypassing the page cache
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#include <sort_benchmark.hpp>
+
+#include "extra/external_sort.hpp"
+
+#include <tlx/die.hpp>
+#include <tlx/string/parse_si_iec_units.hpp>
+#include <tlx/string/starts_with.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/******************************************************************************/
+// Settings
+
+//! starting number of items to sort
+const size_t min_size = 64 * 1024 * 1024;
+
+//! maximum number of items to sort
+const size_t max_size = 1024 * 1024 * 1024;
+
+//! repetitions of each size
+const size_t reps = 3;
+
+//! items generated or checked per slice
+const size_t slice_size = 16 * 1024 * 1024;
+
+/******************************************************************************/
+// Run Sorters
+
+#include "ips4o/ips4o.hpp"
+
+template <typename Item>
+class IPS4oRunSorter {
+public:
+    static const char* name() {
+        return "external_sort+ips4o::parallel_sort";
+    }
+    void operator()(Item* begin, Item* end) {
+        ips4o::parallel::sort(begin, end, std::less<Item>());
+    }
+};
+
+#include <sort_parallel/extra/msd_parallel_radixsort.hpp>
+
+//! extract byte at depth of the order-preserving key of an item
+template <typename Item>
+uint8_t radix_extract_key(const Item& s, size_t depth)
+{
+    using Key = decltype(ItemTraits<Item>::key(s));
+    return tlx::parallel_radixsort_detail::get_key<Key, uint8_t>(
+        ItemTraits<Item>::key(s), depth);
+}
+
+//! the shadow array of one run is allocated with the first run
+template <typename Item>
+class MSDRadixRunSorter {
+public:
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+
+    std::vector<Item> shadow_;
+
+    static const char* name() {
+        return "external_sort+parallel_msd_radixsort";
+    }
+    void operator()(Item* begin, Item* end) {
+        if (shadow_.size() < static_cast<size_t>(end - begin))
+            shadow_.resize(end - begin);
+        tlx::parallel_radixsort_detail::radix_sort<
+            Item*, radix_extract_key<Item>>(
+            begin, end, shadow_.data(), sizeof(Key));
+    }
+};
+
+/******************************************************************************/
+
+//! items with a self-contained file representation, whose input slices can be
+//! generated independently. The index of KeyIndex is set over the whole array.
+template <typename Item>
+struct IsExternalItem
+    : std::integral_constant<
+          bool, std::is_trivially_copyable<Item>::value &&
+          std::is_empty<typename ItemTraits<Item>::Storage>::value &&
+          !std::is_same<Item, KeyIndex>::value &&
+          external_sort::io_alignment % sizeof(Item) == 0> { };
+
+/*!
+ * Sort an input file of size items generated once in the directory, writing
+ * the output file there, and report the I/O volume, the bandwidth during
+ * which I/O requests were executing, and how much of the computation and the
+ * I/O overlapped.
+ */
+template <typename Item, typename RunSorter>
+class ExternalSortBenchmark {
+public:
+    using Traits = ItemTraits<Item>;
+
+    external_sort::Config config_;
+    external_sort::ExternalSorter<Item, RunSorter> sorter_;
+    Distribution distribution_;
+    size_t size_;
+    std::string input_, output_;
+    //! fingerprint of the input
+    uint64_t fingerprint_ = 0;
+
+    ExternalSortBenchmark(size_t size, Distribution distribution,
+        const external_sort::Config& config)
+        : config_(config), sorter_(config, RunSorter()),
+          distribution_(distribution), size_(size),
+          input_(config.temp_dir + "/mbm_external_input.bin"),
+          output_(config.temp_dir + "/mbm_external_output.bin") {
+    }
+
+    ~ExternalSortBenchmark() {
+        unlink(input_.c_str());
+        unlink(output_.c_str());
+    }
+
+    //! write the input file in slices
+    void generate() {
+        external_sort::File file(input_, O_RDWR | O_CREAT | O_TRUNC, false);
+        external_sort::AlignedBuffer buffer(
+            std::min(size_, slice_size) * sizeof(Item));
+        Item* items = reinterpret_cast<Item*>(buffer.data());
+        fingerprint_ = 0;
+        for (size_t begin = 0; begin < size_; begin += slice_size) {
+            size_t end = std::min(begin + slice_size, size_);
+            generate_input_slice<typename Traits::Key>(
+                distribution_, items, size_, 123456, begin, end);
+            fingerprint_ += fingerprint(items, end - begin);
+            file.write(items, (end - begin) * sizeof(Item),
+                begin * sizeof(Item));
+        }
+    }
+
+    //! evict the input from the page cache and truncate the output, such
+    //! that every repetition reads the input from the disk
+    void reset() {
+        external_sort::File(input_, O_RDONLY, false).evict();
+        external_sort::File(output_, O_RDWR | O_CREAT, false).truncate(0);
+    }
+
+    void run() {
+        sorter_.sort(input_, output_);
+    }
+
+    //! check that the output is sorted and a permutation of the input
+    void check() {
+        external_sort::File file(output_, O_RDONLY, false);
+        die_unless(file.size() == size_ * sizeof(Item));
+        external_sort::AlignedBuffer buffer(
+            std::min(size_, slice_size) * sizeof(Item));
+        const Item* items = reinterpret_cast<const Item*>(buffer.data());
+        std::less<Item> cmp;
+        uint64_t sum = 0;
+        Item prev;
+        for (size_t begin = 0; begin < size_; begin += slice_size) {
+            size_t n = std::min(slice_size, size_ - begin);
+            file.read(buffer.data(), n * sizeof(Item), begin * sizeof(Item));
+            die_unless(begin == 0 || !cmp(items[0], prev));
+            die_unless(parallel_is_sorted(items, items + n, cmp));
+            sum += fingerprint(items, n);
+            prev = items[n - 1];
+        }
+        die_unless(sum == fingerprint_);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os,
+        const ExternalSortBenchmark& b) {
+        const external_sort::Stats& s = b.sorter_.stats();
+        double bytes = static_cast<double>(b.size_ * sizeof(Item));
+        double io_bytes = s.io.read_bytes + s.io.write_bytes;
+        double wall = s.run_time + s.merge_time;
+        double cpu_time = wall - s.wait_time;
+        // fraction of the shorter of computation and I/O hidden by the other
+        double overlap = std::min(cpu_time, s.io.busy_time) <= 0 ? 0 :
+                         (cpu_time + s.io.busy_time - wall) /
+                         std::min(cpu_time, s.io.busy_time);
+        return os << "benchmark=" << RunSorter::name() << '\t'
+                  << "item=" << Traits::name() << '\t'
+                  << "item_size=" << sizeof(Item) << '\t'
+                  << "distribution=" << distribution_name(b.distribution_)
+                  << '\t' << "size=" << b.size_ << '\t'
+                  << "bytes=" << b.size_ * sizeof(Item) << '\t'
+                  << "memory=" << b.config_.memory << '\t'
+                  << "block_size=" << b.config_.block_size << '\t'
+                  << "io_threads=" << b.config_.io_threads << '\t'
+                  << "direct_io=" << b.config_.direct_io << '\t'
+                  << "runs=" << s.runs << '\t'
+                  << "run_time=" << s.run_time << '\t'
+                  << "merge_time=" << s.merge_time << '\t'
+                  << "io_read_bytes=" << s.io.read_bytes << '\t'
+                  << "io_write_bytes=" << s.io.write_bytes << '\t'
+                  << "io_volume_ratio=" << io_bytes / bytes << '\t'
+                  << "io_time=" << s.io.busy_time << '\t'
+                  << "io_bandwidth="
+                  << (s.io.busy_time > 0 ? io_bytes / s.io.busy_time / 1e6 : 0)
+                  << '\t'
+                  << "io_wait_time=" << s.wait_time << '\t'
+                  << "cpu_time=" << cpu_time << '\t'
+                  << "overlap=" << std::max(0.0, overlap) << '\t';
+    }
+};
+
+/******************************************************************************/
+
+int main(int argc, char* argv[]) {
+    external_sort::Config config;
+    size_t only_size = 0;
+
+    // parse the options, pass the remaining arguments to the selection
+    std::vector<char*> args = { argv[0] };
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        uint64_t value;
+        auto parse_value = [&](const char* prefix) {
+            if (!tlx::starts_with(arg, prefix))
+                return false;
+            if (!tlx::parse_si_iec_units(
+                    arg.c_str() + strlen(prefix), &value))
+                die("Invalid value in " << arg);
+            return true;
+        };
+        if (parse_value("size="))
+            only_size = value;
+        else if (parse_value("memory="))
+            config.memory = value;
+        else if (parse_value("block="))
+            config.block_size = value;
+        else if (parse_value("io_threads="))
+            config.io_threads = value;
+        else if (tlx::starts_with(arg, "dir="))
+            config.temp_dir = arg.substr(4);
+        else if (arg == "direct")
+            config.direct_io = true;
+        else
+            args.push_back(argv[i]);
+    }
+
+    SortSelection selection(static_cast<int>(args.size()), args.data());
+
+    selection.for_each_item([&](auto tag) {
+        using Item = typename decltype(tag)::type;
+        if constexpr (IsExternalItem<Item>::value) {
+            // MBM_ALGORITHM is defined from cmake to select the run sorter
+            using Benchmark = ExternalSortBenchmark<Item, MBM_ALGORITHM<Item>>;
+
+            // limit the bytes of the items and their storage to those of
+            // max_size MyStruct items
+            size_t max_items = max_size * sizeof(MyStruct) / item_bytes<Item>();
+            size_t first = only_size ? only_size : min_size;
+            size_t last = only_size ? only_size : max_items;
+
+            for (Distribution distribution : selection.distributions_) {
+                for (size_t size = first; size <= last; size *= 2) {
+                    Benchmark benchmark(size, distribution, config);
+                    benchmark.generate();
+                    for (size_t rep = 0; rep < reps; ++rep) {
+                        Microbenchmark mbm;
+                        benchmark.reset();
+                        mbm.run(benchmark);
+                        benchmark.check();
+                        mbm.print(benchmark);
+                    }
+                }
+            }
+        }
+    });
+
+    return 0;
+}
+
+/******************************************************************************/
@@ -0,0 +1,381 @@
+/*******************************************************************************
+ * sort_merge/mbm_sort_merge.cpp
+ *
+ * Microbenchmark merging k sorted runs of the sort benchmark inputs into one
+ * array: cascades of two-way merges, k-way merges with a heap and with loser
+ * trees, and tlx's parallel multiway merge. The runs have equal, random or
+ * skewed lengths and are sorted before the measurement.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#include <sort_benchmark.hpp>
+
+#include "extra/merge.hpp"
+
+#include <tlx/die.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+/******************************************************************************/
+// Settings
+
+//! starting number of items to merge
+const size_t min_size = 1024 * 1024;
+
+//! maximum number of items to merge
+const size_t max_size = 16 * 1024 * 1024;
+
+//! largest number of runs, starting from two and doubling
+const size_t max_runs = 1024;
+
+//! evict CPU caches before each repetition
+const bool flush_cache = false;
+
+/******************************************************************************/
+
+//! distributions of the run lengths
+enum class RunLengths {
+    //! all runs of size / k items
+    Equal,
+    //! uniformly random weights in [1,16)
+    Random,
+    //! Zipf weights 1 / (i + 1), one long run and many short ones
+    Skewed
+};
+
+static const RunLengths all_run_lengths[] = {
+    RunLengths::Equal, RunLengths::Random, RunLengths::Skewed
+};
+
+static inline const char* run_lengths_name(RunLengths r) {
+    switch (r) {
+    case RunLengths::Equal:
+        return "equal";
+    case RunLengths::Random:
+        return "random";
+    case RunLengths::Skewed:
+        return "skewed";
+    }
+    return "unknown";
+}
+
+//! boundaries of k runs splitting size items by the weights of the lengths
+static inline std::vector<size_t> run_bounds(
+    size_t size, size_t k, RunLengths lengths) {
+    std::vector<double> weight(k, 1.0);
+    for (size_t i = 0; i < k; ++i) {
+        if (lengths == RunLengths::Random)
+            weight[i] = 1.0 + 15.0 * SplitMix64(654321, i).uniform();
+        else if (lengths == RunLengths::Skewed)
+            weight[i] = 1.0 / static_cast<double>(i + 1);
+    }
+    double total = 0;
+    for (double w : weight)
+        total += w;
+
+    std::vector<size_t> bounds(k + 1, 0);
+    double prefix = 0;
+    for (size_t i = 0; i < k; ++i) {
+        prefix += weight[i];
+        bounds[i + 1] = static_cast<size_t>(size * (prefix / total));
+    }
+    bounds[k] = size;
+    return bounds;
+}
+
+/*!
+ * Merge k runs of the input of SortBenchmark, which are sorted by reset()
+ * outside of the measurement. run() stores the merged items at result_,
+ * either in vec_ or in target_, which mergers may also use as scratch.
+ */
+template <typename Item>
+class MergeBenchmark : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+
+    //! whether the merger handles the item type
+    static const bool supported = true;
+
+    static const bool count_branch_misses = true;
+
+    //! number of runs and their lengths
+    size_t k_;
+    RunLengths lengths_;
+
+    //! run i is vec_[bounds_[i],bounds_[i+1])
+    std::vector<size_t> bounds_;
+
+    //! merge target of size items
+    Array target_;
+
+    //! begin of the merged items, set by run()
+    Iterator result_;
+
+    //! runs as iterator pairs and bounds, rebuilt by the mergers which
+    //! advance or reduce them, reserved outside of run()
+    std::vector<std::pair<Iterator, Iterator>> seqs_;
+    std::vector<size_t> work_bounds_;
+
+    MergeBenchmark(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : SortBenchmark<Item>(size, distribution), k_(k), lengths_(lengths),
+          bounds_(run_bounds(size, k, lengths)) {
+        this->allocate_scratch(target_, size);
+        seqs_.reserve(k);
+        work_bounds_.reserve(k + 1);
+    }
+
+    //! regenerate the input and sort each run
+    void reset(size_t rep) {
+        SortBenchmark<Item>::reset(rep);
+#pragma omp parallel for schedule(dynamic)
+        for (size_t i = 0; i < k_; ++i) {
+            std::sort(this->vec_.begin() + bounds_[i],
+                this->vec_.begin() + bounds_[i + 1], this->cmp_);
+        }
+    }
+
+    //! fill seqs_ with the runs in vec_
+    void make_sequences() {
+        seqs_.clear();
+        for (size_t i = 0; i < k_; ++i) {
+            seqs_.emplace_back(this->vec_.begin() + bounds_[i],
+                this->vec_.begin() + bounds_[i + 1]);
+        }
+    }
+
+    //! check that the result is sorted and a permutation of the input
+    void check() {
+        const size_t size = this->vec_.size();
+        die_unless(parallel_is_sorted(result_, result_ + size, this->cmp_));
+        die_unless(fingerprint(&*result_, size) == this->fingerprint_);
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const MergeBenchmark& b) {
+        return os << static_cast<const SortBenchmark<Item>&>(b)
+                  << "k=" << b.k_ << '\t'
+                  << "run_lengths=" << run_lengths_name(b.lengths_) << '\t'
+                  << "items_per_second="
+                  << (b.ns_per_item_ > 0 ? 1e9 / b.ns_per_item_ : 0) << '\t';
+    }
+};
+
+/******************************************************************************/
+// Two-Way Merges, cascaded for more than two runs
+
+template <typename Item>
+class StdMerge : public MergeBenchmark<Item> {
+public:
+    using typename MergeBenchmark<Item>::Iterator;
+
+    StdMerge(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : MergeBenchmark<Item>(size, distribution, k, lengths) {
+    }
+    const char* name() const final {
+        return "cascade+std::merge";
+    }
+    void run() {
+        this->work_bounds_ = this->bounds_;
+        this->result_ = merging::cascade_merge(
+            this->vec_.begin(), this->target_.begin(), this->work_bounds_,
+            [&](Iterator a, Iterator a_end, Iterator b, Iterator b_end,
+                Iterator out) {
+                std::merge(a, a_end, b, b_end, out, this->cmp_);
+            });
+    }
+};
+
+template <typename Item>
+class BranchlessMerge : public MergeBenchmark<Item> {
+public:
+    using typename MergeBenchmark<Item>::Iterator;
+
+    BranchlessMerge(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : MergeBenchmark<Item>(size, distribution, k, lengths) {
+    }
+    const char* name() const final {
+        return "cascade+merging::branchless_merge";
+    }
+    void run() {
+        this->work_bounds_ = this->bounds_;
+        this->result_ = merging::cascade_merge(
+            this->vec_.begin(), this->target_.begin(), this->work_bounds_,
+            [&](Iterator a, Iterator a_end, Iterator b, Iterator b_end,
+                Iterator out) {
+                merging::branchless_merge(a, a_end, b, b_end, out, this->cmp_);
+            });
+    }
+};
+
+//! AVX2 bitonic merge of MyStruct as 64-bit words, the only item whose bytes
+//! are an unsigned key followed by a payload of the same width.
+template <typename Item>
+class BitonicMerge : public MergeBenchmark<Item> {
+public:
+    using typename MergeBenchmark<Item>::Iterator;
+
+    static const bool supported = std::is_same<Item, MyStruct>::value;
+
+    BitonicMerge(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : MergeBenchmark<Item>(size, distribution, k, lengths) {
+    }
+    const char* name() const final {
+        return "cascade+merging::bitonic_merge";
+    }
+    void run() {
+        this->work_bounds_ = this->bounds_;
+        this->result_ = merging::cascade_merge(
+            this->vec_.begin(), this->target_.begin(), this->work_bounds_,
+            [&](Iterator a, Iterator a_end, Iterator b, Iterator b_end,
+                Iterator out) {
+                merging::bitonic_merge<merging::WordOrder::Key32Payload32>(
+                    &*a, a_end - a, &*b, b_end - b, &*out, this->cmp_);
+            });
+    }
+};
+
+/******************************************************************************/
+// K-Way Merges
+
+template <typename Item>
+class HeapMerge : public MergeBenchmark<Item> {
+public:
+    HeapMerge(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : MergeBenchmark<Item>(size, distribution, k, lengths) {
+    }
+    const char* name() const final {
+        return "merging::heap_merge";
+    }
+    void run() {
+        this->make_sequences();
+        merging::heap_merge(this->seqs_.begin(), this->seqs_.end(),
+            this->target_.begin(), this->cmp_);
+        this->result_ = this->target_.begin();
+    }
+};
+
+template <typename Item>
+class LoserTreeMerge : public MergeBenchmark<Item> {
+public:
+    LoserTreeMerge(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : MergeBenchmark<Item>(size, distribution, k, lengths) {
+    }
+    const char* name() const final {
+        return "merging::loser_tree_merge";
+    }
+    void run() {
+        this->make_sequences();
+        merging::loser_tree_merge(this->seqs_.begin(), this->seqs_.end(),
+            this->target_.begin(), this->cmp_);
+        this->result_ = this->target_.begin();
+    }
+};
+
+template <typename Item>
+class SentinelLoserTreeMerge : public MergeBenchmark<Item> {
+public:
+    SentinelLoserTreeMerge(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : MergeBenchmark<Item>(size, distribution, k, lengths) {
+    }
+    const char* name() const final {
+        return "merging::sentinel_loser_tree_merge";
+    }
+    void run() {
+        this->make_sequences();
+        merging::sentinel_loser_tree_merge(this->seqs_.begin(),
+            this->seqs_.end(), this->target_.begin(), this->cmp_);
+        this->result_ = this->target_.begin();
+    }
+};
+
+#include <tlx/algorithm/multiway_merge.hpp>
+
+template <typename Item>
+class TlxMultiwayMerge : public MergeBenchmark<Item> {
+public:
+    TlxMultiwayMerge(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : MergeBenchmark<Item>(size, distribution, k, lengths) {
+    }
+    const char* name() const final {
+        return "tlx::multiway_merge";
+    }
+    void run() {
+        this->make_sequences();
+        tlx::multiway_merge(this->seqs_.begin(), this->seqs_.end(),
+            this->target_.begin(), this->vec_.size(), this->cmp_);
+        this->result_ = this->target_.begin();
+    }
+};
+
+#include <tlx/algorithm/parallel_multiway_merge.hpp>
+
+//! each thread merges one part of the output, whose boundaries in all runs
+//! are found by an exact splitter search (multisequence partitioning)
+template <typename Item>
+class ParallelMultiwayMerge : public MergeBenchmark<Item> {
+public:
+    ParallelMultiwayMerge(size_t size, Distribution distribution, size_t k,
+        RunLengths lengths)
+        : MergeBenchmark<Item>(size, distribution, k, lengths) {
+    }
+    const char* name() const final {
+        return "tlx::parallel_multiway_merge";
+    }
+    void run() {
+        this->make_sequences();
+        tlx::parallel_multiway_merge(this->seqs_.begin(), this->seqs_.end(),
+            this->target_.begin(), this->vec_.size(), this->cmp_,
+            tlx::MWMA_ALGORITHM_DEFAULT, tlx::MWMSA_EXACT);
+        this->result_ = this->target_.begin();
+    }
+};
+
+/******************************************************************************/
+
+int main(int argc, char* argv[]) {
+    // distributions and item types can be selected on the command line
+    SortSelection selection(argc, argv);
+
+    selection.for_each_item([&](auto tag) {
+        using Item = typename decltype(tag)::type;
+        // MBM_ALGORITHM is defined from cmake to select algorithm
+        using Benchmark = MBM_ALGORITHM<Item>;
+
+        if constexpr (Benchmark::supported) {
+            // limit the bytes of the items and their storage to those of
+            // max_size MyStruct items
+            size_t max_items = max_size * sizeof(MyStruct) / item_bytes<Item>();
+
+            for (Distribution distribution : selection.distributions_) {
+                for (size_t size = min_size; size <= max_items; size *= 4) {
+                    size_t f = (16 * 1024 * 1024) / size;
+                    size_t reps = std::max<size_t>(3, 3 * f);
+                    for (RunLengths lengths : all_run_lengths) {
+                        for (size_t k = 2; k <= max_runs; k *= 2) {
+                            Benchmark benchmark(size, distribution, k, lengths);
+                            test_benchmark(benchmark, reps, flush_cache);
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    return 0;
+}
+
+/******************************************************************************/
@@ -4,16 +4,20 @@
  *
  * Implementation of three parallel LSD radix sort methods.
  *  radix_sort_prefix_par
- *   Parallel LSD radix sort with key caching
+ *   Parallel LSD radix sort with key caching, optionally redistributing with
+ *   non-temporal stores through write-combining buffers.
  *  radix_sort_prefix_par_no_cache
  *   Parallel LSD radix sort without key caching
  *  radix_sort_prefix_par_no_cache_write_back_buffer
  *   Parallel LSD radix sort without key caching but a write back buffer/cache,
  *   meaning, each thread writes to a local buffer before commiting elements to
- *   the secondary (OOP) array.
- *   WARNING: As the local buffer is on the stack, the size of the (key,value)
- *   elements is limited; depending on the stack size your OS allocates for
- *   each thread. If you get funny segfaults, you probably didn't read this :P
+ *   the secondary (OOP) array (software write-combining). The buffers are
+ *   cache-line aligned heap memory of WriteBackBuffers, by default half of the
+ *   L2 cache per thread, hence any element size works.
+ *  radix_sort_multi_digit_par
+ *   Parallel LSD radix sort with a configurable digit width, which computes
+ *   the histograms of all digits in one initial pass and skips digits in
+ *   which all keys agree.
  *
  *   I suggest you look at the tests to see how to use these functions.
  *
@@ -39,20 +43,29 @@
 #include <vector>
 
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
+#include <new>
 #include <type_traits>
 #include <typeinfo>
 
 #include <omp.h>
+#include <unistd.h>
 
 #include "debug_helper.hpp"
+#include "streaming_scatter.hpp"
 
 namespace rdx {
 
-template <typename Iterator, typename KeyGetter>
-static inline void radix_sort_prefix_par(const Iterator begin,
-                                         const Iterator end,
-                                         const KeyGetter key_getter) {
+// Variant with caller-provided key cache and data cache of element_count
+// items each, which can be reused between calls. With streaming_stores the
+// data is redistributed with non-temporal stores, which skip reading the
+// destination lines.
+template <bool streaming_stores = false, typename Iterator, typename KeyGetter>
+static inline void radix_sort_prefix_par(
+    const Iterator begin, const Iterator end, const KeyGetter key_getter,
+    typename std::iterator_traits<Iterator>::value_type* const data_cache,
+    uint8_t* const key_cache) {
   TIME_START();
 
   // Setup
@@ -62,16 +75,14 @@ static inline void radix_sort_prefix_par(const Iterator begin,
   const size_t element_count = std::distance(begin, end);
 
   // The key cache contains the key value for the current radix
-  // iteration
-  std::unique_ptr<uint8_t[]> key_cache(new uint8_t[element_count]);
-  // Data cache, a buffer which will be used to write the result of a
+  // iteration.
+  // The data cache is a buffer which will be used to write the result of a
   // radix step into. Notice, impl. is out of place.
-  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
 
   // We use pointers internally; we don't have concepts yet...
   data_type* begin_original = &*begin;
   data_type* end_original = &*end;
-  data_type* begin_cache = data_cache.get();
+  data_type* begin_cache = data_cache;
   data_type* end_cache = &(data_cache[element_count - 1]);
 
   TIME_PRINT_RESET("Setup time");
@@ -126,9 +137,19 @@ static inline void radix_sort_prefix_par(const Iterator begin,
       // Make local copy, to minimise false sharing at the boundaries
       // note, std::move would not prevent?
       std::array<data_type*, 256> bucket_local = buckets[omp_get_thread_num()];
+      if (streaming_stores) {
+        streaming_scatter::StreamingScatter<data_type> scatter(256);
+        for (size_t k = 0; k < 256; ++k) scatter.set_bucket(k, bucket_local[k]);
 #pragma omp for schedule(static)
-      for (size_t i = 0; i < element_count; ++i) {
-        *(bucket_local[key_cache[i]]++) = std::move(*(begin_original + i));
+        for (size_t i = 0; i < element_count; ++i) {
+          scatter.push(key_cache[i], std::move(*(begin_original + i)));
+        }
+        scatter.flush();
+      } else {
+#pragma omp for schedule(static)
+        for (size_t i = 0; i < element_count; ++i) {
+          *(bucket_local[key_cache[i]]++) = std::move(*(begin_original + i));
+        }
       }
     }
     TIME_PRINT_RESET("Redistribute data");
@@ -142,14 +163,16 @@ static inline void radix_sort_prefix_par(const Iterator begin,
 
   // If number of iterations was odd (we need to copy)
   if (size_of_key & 1) {
-    std::move(data_cache.get(), data_cache.get() + element_count, begin);
+    std::move(data_cache, data_cache + element_count, begin);
   }
 }
 
+// Variant with a caller-provided data cache of element_count items, which can
+// be reused between calls.
 template <typename Iterator, typename KeyGetter>
-static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
-                                                  const Iterator end,
-                                                  const KeyGetter key_getter) {
+static inline void radix_sort_prefix_par_no_cache(
+    const Iterator begin, const Iterator end, const KeyGetter key_getter,
+    typename std::iterator_traits<Iterator>::value_type* const data_cache) {
   TIME_START();
 
   // Setup
@@ -163,12 +186,11 @@ static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
   // std::unique_ptr<uint8_t[]> key_cache(new uint8_t[element_count]);
   // Data cache, a buffer which will be used to write the result of a
   // radix step into. Notice, impl. is out of place.
-  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
 
   // We use pointers internally; we don't have concepts yet...
   data_type* begin_original = &*begin;
   data_type* end_original = &*end;
-  data_type* begin_cache = data_cache.get();
+  data_type* begin_cache = data_cache;
   data_type* end_cache = &(data_cache[element_count - 1]);
 
   TIME_PRINT_RESET("Setup time");
@@ -238,35 +260,97 @@ static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
 
   // If number of iterations was odd (we need to copy)
   if (size_of_key & 1) {
-    std::move(data_cache.get(), data_cache.get() + element_count, begin);
+    std::move(data_cache, data_cache + element_count, begin);
   }
 }
 
+// Write back buffers of 256 buckets for each thread, on the heap and with
+// each bucket starting at a cache line. Allocate once and reuse them between
+// calls to keep the allocation and page faults out of the sort.
+template <typename data_type>
+class WriteBackBuffers {
+ public:
+  static constexpr size_t cache_line = 64;
+
+  // Half of the L2 cache, leaving room for the streamed input.
+  static size_t default_bytes_per_thread() {
+    long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    return l2 > 0 ? static_cast<size_t>(l2) / 2 : 128 * 1024;
+  }
+
+  WriteBackBuffers(size_t thread_count,
+                   size_t bytes_per_thread = default_bytes_per_thread())
+      : thread_count_(thread_count) {
+    items_per_bucket_ =
+        std::max<size_t>(1, bytes_per_thread / (256 * sizeof(data_type)));
+    bucket_stride_ = (items_per_bucket_ * sizeof(data_type) + cache_line - 1) /
+                     cache_line * cache_line;
+    void* memory = nullptr;
+    if (posix_memalign(&memory, cache_line, bytes()) != 0)
+      throw std::bad_alloc();
+    memory_ = static_cast<char*>(memory);
+    for (size_t t = 0; t < thread_count_; ++t) {
+      for (size_t k = 0; k < 256; ++k)
+        std::uninitialized_default_construct_n(bucket(t, k), items_per_bucket_);
+    }
+  }
+
+  WriteBackBuffers(const WriteBackBuffers&) = delete;
+  WriteBackBuffers& operator=(const WriteBackBuffers&) = delete;
+
+  ~WriteBackBuffers() {
+    for (size_t t = 0; t < thread_count_; ++t) {
+      for (size_t k = 0; k < 256; ++k)
+        std::destroy_n(bucket(t, k), items_per_bucket_);
+    }
+    free(memory_);
+  }
+
+  size_t thread_count() const { return thread_count_; }
+  size_t items_per_bucket() const { return items_per_bucket_; }
+  size_t bytes() const { return thread_count_ * 256 * bucket_stride_; }
+
+  // Buffer of bucket k of thread t.
+  data_type* bucket(size_t t, size_t k) {
+    return reinterpret_cast<data_type*>(memory_ +
+                                        (t * 256 + k) * bucket_stride_);
+  }
+
+ private:
+  size_t thread_count_;
+  size_t items_per_bucket_;
+  size_t bucket_stride_;
+  char* memory_;
+};
+
+// Variant with a caller-provided data cache of element_count items and write
+// back buffers for at least omp_get_max_threads() threads, which can be
+// reused between calls.
 template <typename Iterator, typename KeyGetter>
 static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
-    const Iterator begin, const Iterator end, const KeyGetter key_getter) {
+    const Iterator begin, const Iterator end, const KeyGetter key_getter,
+    typename std::iterator_traits<Iterator>::value_type* const data_cache,
+    WriteBackBuffers<typename std::iterator_traits<Iterator>::value_type>&
+        write_back) {
   TIME_START();
 
   // Setup
   const size_t thread_count = omp_get_max_threads();
   typedef typename std::iterator_traits<Iterator>::value_type data_type;
   constexpr const size_t size_of_key = sizeof(key_getter(*begin));
-  static_assert(sizeof(data_type) <= 16,
-                "Sorted object too large, cache is stack based. The other "
-                "sorts do not have this limitation.");
   const size_t element_count = std::distance(begin, end);
+  assert(write_back.thread_count() >= thread_count);
 
   // The key cache contains the key value for the current radix
   // iteration
   // std::unique_ptr<uint8_t[]> key_cache(new uint8_t[element_count]);
   // Data cache, a buffer which will be used to write the result of a
   // radix step into. Notice, impl. is out of place.
-  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
 
   // We use pointers internally; we don't have concepts yet...
   data_type* begin_original = &*begin;
   data_type* end_original = &*end;
-  data_type* begin_cache = data_cache.get();
+  data_type* begin_cache = data_cache;
   data_type* end_cache = &(data_cache[element_count - 1]);
 
   TIME_PRINT_RESET("Setup time");
@@ -318,11 +402,14 @@ static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
     {
       // Make local copy, to minimise false sharing at the boundaries
       // note, std::move would not prevent?
-      std::array<data_type*, 256> bucket_local = buckets[omp_get_thread_num()];
+      const size_t thread = omp_get_thread_num();
+      std::array<data_type*, 256> bucket_local = buckets[thread];
 
-      constexpr int csize = 256;
-      std::array<std::array<data_type, csize>, 256> local_cache;
-      std::array<uint16_t, 256> local_cache_size{0};
+      const size_t csize = write_back.items_per_bucket();
+      std::array<data_type*, 256> local_cache;
+      for (size_t k = 0; k < 256; ++k)
+        local_cache[k] = write_back.bucket(thread, k);
+      std::array<size_t, 256> local_cache_size{0};
 
 #pragma omp for schedule(static)
       for (size_t i = 0; i < element_count; ++i) {
@@ -330,15 +417,13 @@ static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
         local_cache[k][local_cache_size[k]] = std::move(*(begin_original + i));
         local_cache_size[k]++;
         if (local_cache_size[k] == csize) {
-          std::move(local_cache[k].begin(), local_cache[k].begin() + csize,
-                    bucket_local[k]);
+          std::move(local_cache[k], local_cache[k] + csize, bucket_local[k]);
           bucket_local[k] += csize;
           local_cache_size[k] = 0;
         }
       }
       for (int i = 0; i < 256; ++i) {
-        std::move(local_cache[i].begin(),
-                  local_cache[i].begin() + local_cache_size[i],
+        std::move(local_cache[i], local_cache[i] + local_cache_size[i],
                   bucket_local[i]);
       }
     }
@@ -353,8 +438,196 @@ static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
 
   // If number of iterations was odd (we need to copy)
   if (size_of_key & 1) {
-    std::move(data_cache.get(), data_cache.get() + element_count, begin);
+    std::move(data_cache, data_cache + element_count, begin);
+  }
+}
+
+// Variants allocating the caches for one call.
+
+template <typename Iterator, typename KeyGetter>
+static inline void radix_sort_prefix_par(const Iterator begin,
+                                         const Iterator end,
+                                         const KeyGetter key_getter) {
+  typedef typename std::iterator_traits<Iterator>::value_type data_type;
+  const size_t element_count = std::distance(begin, end);
+
+  std::unique_ptr<uint8_t[]> key_cache(new uint8_t[element_count]);
+  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
+
+  radix_sort_prefix_par(begin, end, key_getter, data_cache.get(),
+                        key_cache.get());
+}
+
+template <typename Iterator, typename KeyGetter>
+static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
+                                                  const Iterator end,
+                                                  const KeyGetter key_getter) {
+  typedef typename std::iterator_traits<Iterator>::value_type data_type;
+  const size_t element_count = std::distance(begin, end);
+
+  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
+
+  radix_sort_prefix_par_no_cache(begin, end, key_getter, data_cache.get());
+}
+
+template <typename Iterator, typename KeyGetter>
+static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
+    const Iterator begin, const Iterator end, const KeyGetter key_getter) {
+  typedef typename std::iterator_traits<Iterator>::value_type data_type;
+  const size_t element_count = std::distance(begin, end);
+
+  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
+  WriteBackBuffers<data_type> write_back(omp_get_max_threads());
+
+  radix_sort_prefix_par_no_cache_write_back_buffer(
+      begin, end, key_getter, data_cache.get(), write_back);
+}
+
+// Work done by radix_sort_multi_digit_par.
+struct MultiDigitStats {
+  size_t digits = 0;
+  // Digits redistributed, the others had only one non-empty bucket.
+  size_t passes = 0;
+  // Bytes of items read and written by all sweeps over the data.
+  size_t bytes_moved = 0;
+};
+
+// Parallel LSD radix sort of unsigned integer keys in digits of digit_bits
+// bits with a caller-provided data cache of element_count items. One sweep
+// counts all digits of each thread's part of the input, which yields the
+// global histograms and the thread offsets of the first redistribution.
+// Digits with a single non-empty bucket are skipped. Later passes still count
+// the thread parts of the current order, since a stable parallel scatter
+// needs them.
+template <size_t digit_bits = 8, typename Iterator, typename KeyGetter>
+static inline MultiDigitStats radix_sort_multi_digit_par(
+    const Iterator begin, const Iterator end, const KeyGetter key_getter,
+    typename std::iterator_traits<Iterator>::value_type* const data_cache) {
+  TIME_START();
+
+  // Setup
+  const size_t thread_count = omp_get_max_threads();
+  typedef typename std::iterator_traits<Iterator>::value_type data_type;
+  typedef decltype(key_getter(*begin)) key_type;
+  static_assert(std::is_unsigned<key_type>::value,
+                "Keys must be unsigned integers.");
+  static_assert(digit_bits >= 1 && digit_bits <= 16,
+                "Digits must have 1 to 16 bits.");
+  constexpr size_t radix = size_t(1) << digit_bits;
+  constexpr size_t digit_count =
+      (sizeof(key_type) * 8 + digit_bits - 1) / digit_bits;
+  const size_t element_count = std::distance(begin, end);
+  const size_t sweep_bytes = element_count * sizeof(data_type);
+
+  MultiDigitStats stats;
+  stats.digits = digit_count;
+  if (element_count == 0) return stats;
+
+  auto digit = [](const key_type& key, size_t d) {
+    return static_cast<size_t>((key >> (d * digit_bits)) & (radix - 1));
+  };
+  // Thread t works on [part(t), part(t + 1)) in every sweep.
+  auto part = [=](size_t t) { return element_count * t / thread_count; };
+
+  data_type* begin_original = &*begin;
+  data_type* begin_cache = data_cache;
+
+  // histograms[t][d * radix + k]: items of digit d equal to k in part t
+  std::vector<std::vector<size_t>> histograms(
+      thread_count, std::vector<size_t>(digit_count * radix));
+
+  TIME_PRINT_RESET("Setup time");
+
+// count all digits in one sweep
+#pragma omp parallel for schedule(static, 1)
+  for (size_t t = 0; t < thread_count; ++t) {
+    std::vector<size_t> local(digit_count * radix);
+    for (size_t i = part(t); i < part(t + 1); ++i) {
+      const key_type key = key_getter(begin_original[i]);
+      for (size_t d = 0; d < digit_count; ++d)
+        ++local[d * radix + digit(key, d)];
+    }
+    histograms[t] = std::move(local);
+  }
+  stats.bytes_moved += sweep_bytes;
+  TIME_PRINT_RESET("Find all bucket sizes");
+
+  // a digit is trivial if one bucket holds all items
+  std::vector<size_t> passes;
+  for (size_t d = 0; d < digit_count; ++d) {
+    bool trivial = false;
+    for (size_t k = 0; k < radix && !trivial; ++k) {
+      size_t sum = 0;
+      for (size_t t = 0; t < thread_count; ++t)
+        sum += histograms[t][d * radix + k];
+      trivial = (sum == element_count);
+    }
+    if (!trivial) passes.push_back(d);
   }
+
+  std::vector<std::vector<data_type*>> buckets(thread_count,
+                                               std::vector<data_type*>(radix));
+
+  // Start of actual work//////////////////
+  for (size_t p = 0; p < passes.size(); ++p) {
+    const size_t d = passes[p];
+
+    // the initial histograms are those of the input order
+    if (p != 0) {
+#pragma omp parallel for schedule(static, 1)
+      for (size_t t = 0; t < thread_count; ++t) {
+        size_t* local = histograms[t].data() + d * radix;
+        std::fill(local, local + radix, 0);
+        for (size_t i = part(t); i < part(t + 1); ++i)
+          ++local[digit(key_getter(begin_original[i]), d)];
+      }
+      stats.bytes_moved += sweep_bytes;
+      TIME_PRINT_RESET("Find bucket size");
+    }
+
+    // Snake prefix sum
+    data_type* offset = begin_cache;
+    for (size_t k = 0; k < radix; ++k) {
+      for (size_t t = 0; t < thread_count; ++t) {
+        buckets[t][k] = offset;
+        offset += histograms[t][d * radix + k];
+      }
+    }
+    TIME_PRINT_RESET("Create initial buckets");
+
+// Redistribute the data
+#pragma omp parallel for schedule(static, 1)
+    for (size_t t = 0; t < thread_count; ++t) {
+      std::vector<data_type*>& bucket_local = buckets[t];
+      for (size_t i = part(t); i < part(t + 1); ++i) {
+        const size_t k = digit(key_getter(begin_original[i]), d);
+        *(bucket_local[k]++) = std::move(begin_original[i]);
+      }
+    }
+    stats.bytes_moved += 2 * sweep_bytes;
+    TIME_PRINT_RESET("Redistribute data");
+
+    std::swap(begin_original, begin_cache);
+  }
+  // End of actual work//////////////////////
+
+  stats.passes = passes.size();
+  if (stats.passes & 1) {
+    std::move(data_cache, data_cache + element_count, begin);
+    stats.bytes_moved += 2 * sweep_bytes;
+  }
+  return stats;
+}
+
+template <size_t digit_bits = 8, typename Iterator, typename KeyGetter>
+static inline MultiDigitStats radix_sort_multi_digit_par(
+    const Iterator begin, const Iterator end, const KeyGetter key_getter) {
+  typedef typename std::iterator_traits<Iterator>::value_type data_type;
+  const size_t element_count = std::distance(begin, end);
+  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
+
+  return radix_sort_multi_digit_par<digit_bits>(begin, end, key_getter,
+                                                data_cache.get());
 }
 
 }  // namespace rdx
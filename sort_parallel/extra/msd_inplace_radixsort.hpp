@@ -0,0 +1,333 @@
+/*******************************************************************************
+ * sort_parallel/extra/msd_inplace_radixsort.hpp
+ *
+ * In-place variant of the parallel MSD radix sort, which needs no shadow
+ * array. Large buckets are distributed in parallel in the style of PARADIS
+ * (Cho et al., VLDB 2015): each round splits the unplaced range of every
+ * bucket into one stripe per part, the parts permute their stripes
+ * speculatively with cycle leaders, and a repair pass moves the items which
+ * could not be placed to the back of their current bucket for the next round.
+ * Small buckets are sorted by the in-place sequential SmallsortJob.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef PRS_MSD_INPLACE_RADIX_SORT_HEADER
+#define PRS_MSD_INPLACE_RADIX_SORT_HEADER
+
+#include "msd_parallel_radixsort.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+
+namespace tlx {
+namespace parallel_radixsort_detail {
+
+/******************************************************************************/
+//! Parameters of the in-place sort
+
+template <typename Iterator_, typename key_type_,
+          key_type_ (*key_extractor_)(
+              const typename std::iterator_traits<Iterator_>::value_type& v,
+              size_t depth)>
+class PRSParametersInPlace
+    : public PRSParametersDefault<Iterator_, key_type_, key_extractor_>
+{
+public:
+    static const bool inplace_sequential_sort = true;
+
+    static const bool enable_inplace_parallel_radix_sort = true;
+};
+
+// ****************************************************************************
+// *** InPlaceRadixStep in-place 8- or 16-bit parallel radix sort with Jobs
+
+template <typename Context, typename DataPtr>
+struct InPlaceRadixStep
+{
+    typedef typename Context::key_type key_type;
+    typedef typename Context::value_type value_type;
+
+    typedef typename DataPtr::DataSet DataSet;
+    typedef typename DataSet::Iterator Iterator;
+
+    static const size_t numbkts = key_traits<key_type>::radix;
+
+    DataPtr             dptr;
+    size_t              depth;
+
+    size_t              parts;
+    size_t              psize;
+    std::atomic<size_t> pwork;
+
+    //! parts of the current round, one if the last round made no progress
+    size_t              rparts;
+    //! unplaced items before the current round
+    size_t              unplaced;
+
+    //! bucket boundaries, numbkts + 1
+    size_t              * bkt;
+    //! first unplaced and end position of each bucket
+    size_t              * head, * tail;
+    //! per part counts, then stripes of the round: parts * numbkts each
+    size_t              * phead, * ptail;
+
+    InPlaceRadixStep(Context& ctx, const DataPtr& dptr, size_t _depth);
+
+    void                count(size_t p, Context& ctx);
+    void                count_finished(Context& ctx);
+
+    void                start_round(Context& ctx);
+    void                permute(size_t p, Context& ctx);
+    void                permute_finished(Context& ctx);
+
+    void                repair(size_t p, Context& ctx);
+    void                repair_finished(Context& ctx);
+
+    void                finish(Context& ctx);
+
+    static size_t       key(const value_type& v, size_t depth) {
+        return static_cast<size_t>(Context::key_extractor(v, depth));
+    }
+};
+
+template <typename Context, typename DataPtr>
+InPlaceRadixStep<Context, DataPtr>::InPlaceRadixStep(
+    Context& ctx, const DataPtr& _dptr, size_t _depth)
+    : dptr(_dptr), depth(_depth)
+{
+    size_t n = dptr.size();
+
+    parts = (n + ctx.sequential_threshold() - 1) / ctx.sequential_threshold();
+    if (parts == 0) parts = 1;
+
+    psize = (n + parts - 1) / parts;
+
+    LOGC(ctx.debug_jobs)
+        << "In-place area split into " << parts << " parts of size " << psize;
+
+    bkt = ctx.allocate_array(3 * numbkts + 1 + 2 * parts * numbkts);
+    head = bkt + numbkts + 1;
+    tail = head + numbkts;
+    phead = tail + numbkts;
+    ptail = phead + parts * numbkts;
+
+    // create worker jobs
+    pwork = parts;
+    for (size_t p = 0; p < parts; ++p)
+        ctx.threads_.enqueue([this, p, &ctx]() { count(p, ctx); });
+}
+
+template <typename Context, typename DataPtr>
+void InPlaceRadixStep<Context, DataPtr>::count(size_t p, Context& ctx)
+{
+    LOGC(ctx.debug_jobs)
+        << "Process InPlaceCountJob " << p << " @ " << this;
+
+    const DataSet& ds = dptr.active();
+    Iterator itB = ds.begin() + std::min(p * psize, dptr.size());
+    Iterator itE = ds.begin() + std::min((p + 1) * psize, dptr.size());
+
+    size_t mybkt[numbkts] = { 0 };
+    for (Iterator it = itB; it != itE; ++it)
+        ++mybkt[key(*it, depth)];
+
+    memcpy(phead + p * numbkts, mybkt, sizeof(mybkt));
+
+    if (--pwork == 0)
+        count_finished(ctx);
+}
+
+template <typename Context, typename DataPtr>
+void InPlaceRadixStep<Context, DataPtr>::count_finished(Context& ctx)
+{
+    LOGC(ctx.debug_jobs)
+        << "Finishing InPlaceCountJob " << this << " with prefixsum";
+
+    // exclusive prefix sum of the bucket sizes
+    size_t sum = 0;
+    for (size_t i = 0; i < numbkts; ++i)
+    {
+        bkt[i] = head[i] = sum;
+        for (size_t p = 0; p < parts; ++p)
+            sum += phead[p * numbkts + i];
+        tail[i] = sum;
+    }
+    bkt[numbkts] = sum;
+    assert(sum == dptr.size());
+
+    unplaced = dptr.size();
+    rparts = parts;
+    start_round(ctx);
+}
+
+template <typename Context, typename DataPtr>
+void InPlaceRadixStep<Context, DataPtr>::start_round(Context& ctx)
+{
+    // split the unplaced range of each bucket into rparts stripes
+    for (size_t i = 0; i < numbkts; ++i)
+    {
+        size_t size = tail[i] - head[i];
+        for (size_t p = 0; p < rparts; ++p) {
+            phead[p * numbkts + i] = head[i] + size * p / rparts;
+            ptail[p * numbkts + i] = head[i] + size * (p + 1) / rparts;
+        }
+    }
+
+    pwork = rparts;
+    for (size_t p = 0; p < rparts; ++p)
+        ctx.threads_.enqueue([this, p, &ctx]() { permute(p, ctx); });
+}
+
+template <typename Context, typename DataPtr>
+void InPlaceRadixStep<Context, DataPtr>::permute(size_t p, Context& ctx)
+{
+    LOGC(ctx.debug_jobs)
+        << "Process InPlacePermuteJob " << p << " @ " << this;
+
+    Iterator a = dptr.active().begin();
+    size_t* mhead = phead + p * numbkts;
+    const size_t* mtail = ptail + p * numbkts;
+
+    // cycle leaders within the stripes of this part: items are swapped into
+    // the stripe of their bucket while it has room, otherwise they remain
+    // misplaced for the repair.
+    for (size_t i = 0; i < numbkts; ++i)
+    {
+        while (mhead[i] < mtail[i])
+        {
+            value_type v = std::move(*(a + mhead[i]));
+            size_t k = key(v, depth);
+            while (k != i && mhead[k] < mtail[k]) {
+                std::swap(v, *(a + mhead[k]++));
+                k = key(v, depth);
+            }
+            *(a + mhead[i]++) = std::move(v);
+        }
+    }
+
+    if (--pwork == 0)
+        permute_finished(ctx);
+}
+
+template <typename Context, typename DataPtr>
+void InPlaceRadixStep<Context, DataPtr>::permute_finished(Context& ctx)
+{
+    pwork = parts;
+    for (size_t p = 0; p < parts; ++p)
+        ctx.threads_.enqueue([this, p, &ctx]() { repair(p, ctx); });
+}
+
+template <typename Context, typename DataPtr>
+void InPlaceRadixStep<Context, DataPtr>::repair(size_t p, Context& ctx)
+{
+    LOGC(ctx.debug_jobs)
+        << "Process InPlaceRepairJob " << p << " @ " << this;
+
+    // move the misplaced items of a range of buckets to their backs
+    Iterator a = dptr.active().begin();
+    for (size_t i = numbkts * p / parts; i < numbkts * (p + 1) / parts; ++i)
+    {
+        Iterator mid = std::partition(
+            a + head[i], a + tail[i],
+            [this, i](const value_type& v) { return key(v, depth) == i; });
+        head[i] = mid - a;
+    }
+
+    if (--pwork == 0)
+        repair_finished(ctx);
+}
+
+template <typename Context, typename DataPtr>
+void InPlaceRadixStep<Context, DataPtr>::repair_finished(Context& ctx)
+{
+    size_t rest = 0;
+    for (size_t i = 0; i < numbkts; ++i)
+        rest += tail[i] - head[i];
+
+    LOGC(ctx.debug_jobs)
+        << "Finishing InPlaceRepairJob " << this << " with " << rest
+        << " unplaced items";
+
+    if (rest == 0)
+        return finish(ctx);
+
+    // a round on one part places all items, fall back to it if the stripes
+    // got too unbalanced to make progress
+    rparts = (rest < unplaced && rest > ctx.subsort_threshold) ? parts : 1;
+    unplaced = rest;
+    start_round(ctx);
+}
+
+template <typename Context, typename DataPtr>
+void InPlaceRadixStep<Context, DataPtr>::finish(Context& ctx)
+{
+    for (size_t i = 0; i < numbkts; ++i)
+    {
+        size_t size = bkt[i + 1] - bkt[i];
+        if (size == 0)
+            continue;
+        else if (size == 1 || depth + 1 >= ctx.max_depth)
+            ctx.donesize(size);
+        else
+            ctx.enqueue(dptr.sub(bkt[i], size), depth + 1);
+    }
+
+    ctx.free_array(bkt);
+    ctx.destroy(this);
+}
+
+/******************************************************************************/
+// Frontends
+
+/*!
+ * Radix sort [begin,end) in place with PRSParameters which enable
+ * inplace_sequential_sort and enable_inplace_parallel_radix_sort. The extra
+ * memory is that of the jobs and their bucket arrays.
+ */
+template <typename PRSParameters, typename Iterator>
+static inline
+void radix_sort_inplace_params(
+    Iterator begin, Iterator end, size_t max_depth,
+    size_t num_threads = std::thread::hardware_concurrency())
+{
+    static_assert(PRSParameters::inplace_sequential_sort &&
+                  PRSParameters::enable_inplace_parallel_radix_sort,
+                  "parameters must select the in-place sorts");
+    using Context = PRSContext<PRSParameters>;
+
+    Context ctx(num_threads, max_depth);
+    ctx.totalsize = end - begin;
+    ctx.rest_size = ctx.totalsize;
+
+    // the shadow array is never used
+    ctx.enqueue(ShadowDataPtr<DummyDataSet<Iterator> >(
+                    begin, end, begin, end), 0);
+
+    ctx.threads_.loop_until_empty();
+
+    assert(!ctx.enable_rest_size || ctx.rest_size == 0);
+}
+
+template <typename Iterator,
+    uint8_t (*key_extractor)(
+        const typename std::iterator_traits<Iterator>::value_type&, size_t)>
+static inline
+void radix_sort_inplace(
+    Iterator begin, Iterator end, size_t max_depth,
+    size_t num_threads = std::thread::hardware_concurrency())
+{
+    radix_sort_inplace_params<
+        PRSParametersInPlace<Iterator, uint8_t, key_extractor>, Iterator>(
+            begin, end, max_depth, num_threads);
+}
+
+} // namespace parallel_radixsort_detail
+} // namespace tlx
+
+#endif // !PRS_MSD_INPLACE_RADIX_SORT_HEADER
+
+/******************************************************************************/
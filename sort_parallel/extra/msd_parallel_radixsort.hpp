@@ -24,9 +24,16 @@
 #ifndef PRS_PARALLEL_MSD_RADIX_SORT_HEADER
 #define PRS_PARALLEL_MSD_RADIX_SORT_HEADER
 
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
+#include "radix_sort_workspace.hpp"
 #include "shadow_set.hpp"
+#include "streaming_scatter.hpp"
 
 #include <tlx/logger.hpp>
 #include <tlx/thread_pool.hpp>
@@ -45,6 +52,153 @@ KeyType get_key(const ValueType& v, size_t depth)
 }
 
 
+/******************************************************************************/
+//! Order-Preserving Radix Keys
+
+//! unsigned integers are their own radix representation
+template <typename Key>
+inline
+typename std::enable_if<std::is_integral<Key>::value &&
+                        std::is_unsigned<Key>::value, Key>::type
+radix_uint(const Key& k)
+{
+    return k;
+}
+
+//! signed integers are ordered as unsigned ones with the sign bit flipped
+template <typename Key>
+inline
+typename std::enable_if<std::is_integral<Key>::value &&
+                        std::is_signed<Key>::value,
+                        typename std::make_unsigned<Key>::type>::type
+radix_uint(const Key& k)
+{
+    using UInt = typename std::make_unsigned<Key>::type;
+    return static_cast<UInt>(k) ^ (UInt(1) << (8 * sizeof(Key) - 1));
+}
+
+#if defined(__SIZEOF_INT128__)
+__extension__ typedef __int128 int128;
+__extension__ typedef unsigned __int128 uint128;
+
+inline uint128 radix_uint(const uint128& k)
+{
+    return k;
+}
+
+inline uint128 radix_uint(const int128& k)
+{
+    return static_cast<uint128>(k) ^ (static_cast<uint128>(1) << 127);
+}
+#endif
+
+//! IEEE floats in totalOrder: negative ones with all bits flipped, positive
+//! ones with the sign bit set
+template <typename Float, typename UInt>
+inline
+UInt radix_float_uint(const Float& f)
+{
+    static_assert(sizeof(UInt) == sizeof(Float), "size mismatch");
+    const UInt sign = UInt(1) << (8 * sizeof(UInt) - 1);
+    UInt u;
+    memcpy(&u, &f, sizeof(u));
+    return (u & sign) ? ~u : (u ^ sign);
+}
+
+inline uint32_t radix_uint(const float& f)
+{
+    return radix_float_uint<float, uint32_t>(f);
+}
+
+inline uint64_t radix_uint(const double& f)
+{
+    return radix_float_uint<double, uint64_t>(f);
+}
+
+/*!
+ * Maps keys to byte strings whose lexicographic order is the order of the
+ * keys: scalars as the big-endian bytes of their radix_uint(), pairs and
+ * tuples as the concatenation of their fields. bytes is the length of the
+ * strings and hence the maximum depth in bytes.
+ */
+template <typename Key>
+struct radix_key
+{
+    using UInt = decltype(radix_uint(std::declval<const Key&>()));
+
+    static const size_t bytes = sizeof(UInt);
+
+    static uint8_t byte(const Key& k, size_t depth) {
+        return static_cast<uint8_t>(radix_uint(k) >> (8 * (bytes - 1 - depth)));
+    }
+};
+
+template <typename First, typename Second>
+struct radix_key<std::pair<First, Second> >
+{
+    static const size_t bytes =
+        radix_key<First>::bytes + radix_key<Second>::bytes;
+
+    static uint8_t byte(const std::pair<First, Second>& k, size_t depth) {
+        if (depth < radix_key<First>::bytes)
+            return radix_key<First>::byte(k.first, depth);
+        return radix_key<Second>::byte(
+            k.second, depth - radix_key<First>::bytes);
+    }
+};
+
+template <typename... Fields>
+struct radix_key<std::tuple<Fields...> >
+{
+    static const size_t bytes = (0 + ... + radix_key<Fields>::bytes);
+
+    static uint8_t byte(const std::tuple<Fields...>& k, size_t depth) {
+        return field_byte<0>(k, depth);
+    }
+
+private:
+    template <size_t I>
+    static uint8_t field_byte(const std::tuple<Fields...>& k, size_t depth) {
+        using Field = typename std::tuple_element<
+            I, std::tuple<Fields...> >::type;
+        if constexpr (I + 1 < sizeof...(Fields)) {
+            if (depth >= radix_key<Field>::bytes)
+                return field_byte<I + 1>(k, depth - radix_key<Field>::bytes);
+        }
+        return radix_key<Field>::byte(std::get<I>(k), depth);
+    }
+};
+
+//! digit of type KeyType at depth, counted in KeyType digits, of the radix
+//! key of k, padded with zero bytes beyond its end.
+template <typename KeyType, typename Key>
+inline
+KeyType radix_digit(const Key& k, size_t depth)
+{
+    size_t digit = 0;
+    for (size_t i = 0; i < sizeof(KeyType); ++i) {
+        size_t d = depth * sizeof(KeyType) + i;
+        digit = (digit << 8) |
+                (d < radix_key<Key>::bytes ? radix_key<Key>::byte(k, d) : 0);
+    }
+    return static_cast<KeyType>(digit);
+}
+
+//! number of KeyType digits of the radix key of Key
+template <typename KeyType, typename Key>
+constexpr size_t radix_depth()
+{
+    return (radix_key<Key>::bytes + sizeof(KeyType) - 1) / sizeof(KeyType);
+}
+
+//! key_extractor of the radix key returned by KeyFunction for an item
+template <typename Value, typename KeyType, auto KeyFunction>
+inline
+KeyType radix_key_extractor(const Value& v, size_t depth)
+{
+    return radix_digit<KeyType>(KeyFunction(v), depth);
+}
+
 /// Return traits of key_type
 template <typename CharT>
 class key_traits
@@ -66,6 +220,40 @@ public:
     static const size_t add_depth = 2;
 };
 
+/******************************************************************************/
+//! Digits of the Parallel Radix Steps
+
+//! digit of the context's key_type at each depth
+template <typename Context>
+struct ContextDigit
+{
+    typedef typename Context::key_type key_type;
+
+    //! depth advanced by one step
+    static const size_t depth_step = 1;
+
+    static size_t key(const typename Context::value_type& v, size_t depth) {
+        return static_cast<size_t>(Context::key_extractor(v, depth));
+    }
+};
+
+//! 16-bit digit of two consecutive 8-bit digits of the context
+template <typename Context>
+struct WideDigit
+{
+    static_assert(std::is_same<typename Context::key_type, uint8_t>::value,
+                  "wide digits combine two 8-bit digits");
+
+    typedef uint16_t key_type;
+
+    static const size_t depth_step = 2;
+
+    static size_t key(const typename Context::value_type& v, size_t depth) {
+        return (static_cast<size_t>(Context::key_extractor(v, depth)) << 8) |
+               static_cast<size_t>(Context::key_extractor(v, depth + 1));
+    }
+};
+
 /******************************************************************************/
 //! Parallel Radix Sort Parameter Struct
 
@@ -102,12 +290,39 @@ public:
     //! set or on the whole data set.
     static const bool enable_rest_size = false;
 
-    //! threshold to switch to insertion sort
+    //! threshold to switch to insertion sort, the default of
+    //! PRSContext::subsort_threshold
     static const size_t subsort_threshold = 32;
 
     //! whether to use in-place sequential sort
     static const bool inplace_sequential_sort = false;
 
+    //! whether buckets below subsort_threshold are insertion sorted on their
+    //! digits from the bucket's depth on, instead of by sub_sort on whole items
+    static const bool sub_sort_from_depth = false;
+
+    //! whether the parallel distribution scatters through write-combining
+    //! buffers with non-temporal stores
+    static const bool enable_streaming_stores = false;
+
+    //! whether large buckets are distributed in-place by InPlaceRadixStep, see
+    //! msd_inplace_radixsort.hpp, instead of through the shadow array
+    static const bool enable_inplace_parallel_radix_sort = false;
+
+    //! whether large buckets are distributed on WideDigit, two 8-bit digits
+    //! at once, if use_wide_digit() expects this to pay off
+    static const bool enable_adaptive_digits = false;
+
+    //! minimum items per part and 16-bit counter of a WideDigit step
+    static const size_t wide_digit_items_per_counter = 16;
+
+    //! minimum distinct 16-bit digits in a sample for a WideDigit step
+    static const size_t wide_digit_min_distinct = 256;
+
+    //! thread pool running the jobs, tlx::ThreadPool with one shared queue
+    //! or WorkStealingPool, see work_stealing_pool.hpp
+    typedef ThreadPool thread_pool_type;
+
     //! comparator for the sub-sorter
     constexpr static std::less<value_type> cmp = std::less<value_type>();
 
@@ -140,19 +355,102 @@ public:
     //! number of threads overall
     size_t num_threads;
 
+    typedef typename Parameters::thread_pool_type thread_pool_type;
+
+    //! thread pool of the context, unless a workspace provides one
+    std::unique_ptr<thread_pool_type> own_threads_;
+
     //! thread pool
-    ThreadPool threads_;
+    thread_pool_type& threads_;
+
+    //! arena of jobs and bucket arrays, or nullptr to use the heap
+    JobArena* arena_ = nullptr;
 
     //! maximum depth from which to switch to sub_sort
     size_t max_depth;
 
+    //! bucket size below which to switch to sub_sort, hides the parameter
+    size_t subsort_threshold = Parameters::subsort_threshold;
+
     //! context constructor
     PRSContext(size_t _thread_num, size_t _max_depth)
         : num_threads(_thread_num),
-          threads_(_thread_num),
+          own_threads_(new thread_pool_type(_thread_num)),
+          threads_(*own_threads_),
           max_depth(_max_depth)
     { }
 
+    //! context constructor using the threads and arena of a workspace
+    PRSContext(BasicRadixSortWorkspace<thread_pool_type>& workspace,
+               size_t _max_depth)
+        : num_threads(workspace.num_threads()),
+          threads_(workspace.threads()),
+          arena_(&workspace.arena()),
+          max_depth(_max_depth)
+    { }
+
+    //! sort a bucket below subsort_threshold, whose items agree on the
+    //! digits before depth
+    template <typename Iterator>
+    void sort_bucket(Iterator begin, Iterator end, size_t depth) {
+        if constexpr (Parameters::sub_sort_from_depth) {
+            for (Iterator i = begin; i != end; ++i) {
+                typename Parameters::value_type v = std::move(*i);
+                Iterator j = i;
+                for ( ; j != begin && digits_less(v, *(j - 1), depth); --j)
+                    *j = std::move(*(j - 1));
+                *j = std::move(v);
+            }
+        }
+        else {
+            this->sub_sort(begin, end, this->cmp);
+        }
+    }
+
+    //! compare the digits of a and b from depth to max_depth
+    bool digits_less(const typename Parameters::value_type& a,
+                     const typename Parameters::value_type& b,
+                     size_t depth) const {
+        for ( ; depth < max_depth; ++depth) {
+            typename Parameters::key_type ka = this->key_extractor(a, depth);
+            typename Parameters::key_type kb = this->key_extractor(b, depth);
+            if (ka != kb)
+                return ka < kb;
+        }
+        return false;
+    }
+
+    //! construct a job in the arena or on the heap
+    template <typename Job, typename ... Args>
+    Job * create(Args&& ... args) {
+        if (!arena_)
+            return new Job(std::forward<Args>(args) ...);
+        return new (arena_->allocate(sizeof(Job)))
+               Job(std::forward<Args>(args) ...);
+    }
+
+    //! destroy a job of create(), the arena releases its memory in one go
+    template <typename Job>
+    void destroy(Job* job) {
+        if (!arena_)
+            delete job;
+        else
+            job->~Job();
+    }
+
+    //! allocate an uninitialized array of n size_t in the arena or on the heap
+    size_t * allocate_array(size_t n) {
+        if (!arena_)
+            return new size_t[n];
+        return static_cast<size_t*>(arena_->allocate(n * sizeof(size_t)));
+    }
+
+    //! free an array of allocate_array()
+    void free_array(size_t* array) {
+        if (!arena_)
+            delete[] array;
+    }
+
     //! enqueue a new job in the thread pool
     template <typename DataPtr>
     void enqueue(const DataPtr& dptr, size_t depth);
@@ -161,6 +459,10 @@ public:
     template <typename DataPtr>
     void enqueue_small_job(const DataPtr& dptr, size_t depth);
 
+    //! whether to distribute a large bucket on a 16-bit digit
+    template <typename DataPtr>
+    bool use_wide_digit(const DataPtr& dptr, size_t depth);
+
     //! return sequential sorting threshold
     size_t sequential_threshold() {
         // size_t threshold = this->smallsort_threshold;
@@ -284,20 +586,20 @@ struct SmallsortJob final
         dptr = dptr.copy_back();
 
         if (n < ctx.subsort_threshold) {
-            // FIXME maybe start from depth `depth`
-            // insertion_sort(dptr.copy_back(), depth, 0);
             DataSet ds = dptr.copy_back().active();
-            ctx.sub_sort(ds.begin(), ds.end(), ctx.cmp);
+            ctx.sort_bucket(ds.begin(), ds.end(), depth);
             ctx.donesize(n);
 
-            delete this;
+            ctx.destroy(this);
             return;
         }
 
         // std::deque is much slower than std::vector, so we use an artificial
-        // pop_front variable.
+        // pop_front variable. Jobs run one after another on a thread, hence
+        // each thread reuses one stack and its capacity.
         size_t pop_front = 0;
-        std::vector<RadixStep_CI> radixstack;
+        static thread_local std::vector<RadixStep_CI> radixstack;
+        radixstack.clear();
         radixstack.emplace_back(dptr, depth);
 
         while (radixstack.size() > pop_front)
@@ -323,9 +625,10 @@ struct SmallsortJob final
                 }
                 else if (bktsize < ctx.subsort_threshold)
                 {
-                    // FIXME maybe start from depth `depth`
+                    // the bucket agrees on the digits of the stack's levels
                     DataSet ds = rs.dptr.sub(rs.bkt[b], bktsize).copy_back().active();
-                    ctx.sub_sort(ds.begin(), ds.end(), ctx.cmp);
+                    ctx.sort_bucket(ds.begin(), ds.end(),
+                                    depth + radixstack.size());
                     ctx.donesize(bktsize);
                 }
                 else
@@ -363,17 +666,18 @@ struct SmallsortJob final
             radixstack.pop_back();
         }
 
-        delete this;
+        ctx.destroy(this);
     }
 };
 
 // ****************************************************************************
 // *** BigRadixStepCE out-of-place 8- or 16-bit parallel radix sort with Jobs
 
-template <typename Context, typename DataPtr>
+template <typename Context, typename DataPtr,
+          typename Digit = ContextDigit<Context> >
 struct BigRadixStepCE
 {
-    typedef typename Context::key_type key_type;
+    typedef typename Digit::key_type key_type;
     typedef typename Context::value_type value_type;
 
     typedef typename DataPtr::DataSet DataSet;
@@ -398,8 +702,8 @@ struct BigRadixStepCE
     void                distribute_finished(Context& ctx);
 };
 
-template <typename Context, typename DataPtr>
-BigRadixStepCE<Context, DataPtr>::BigRadixStepCE(
+template <typename Context, typename DataPtr, typename Digit>
+BigRadixStepCE<Context, DataPtr, Digit>::BigRadixStepCE(
     Context& ctx, const DataPtr& _dptr, size_t _depth)
     : dptr(_dptr), depth(_depth)
 {
@@ -413,7 +717,7 @@ BigRadixStepCE<Context, DataPtr>::BigRadixStepCE(
     LOGC(ctx.debug_jobs)
         << "Area split into " << parts << " parts of size " << psize;
 
-    bkt = new size_t[numbkts * parts + 1];
+    bkt = ctx.allocate_array(numbkts * parts + 1);
 
     // create worker jobs
     pwork = parts;
@@ -421,8 +725,8 @@ BigRadixStepCE<Context, DataPtr>::BigRadixStepCE(
         ctx.threads_.enqueue([this, p, &ctx]() { count(p, ctx); });
 }
 
-template <typename Context, typename DataPtr>
-void BigRadixStepCE<Context, DataPtr>::count(size_t p, Context& ctx)
+template <typename Context, typename DataPtr, typename Digit>
+void BigRadixStepCE<Context, DataPtr, Digit>::count(size_t p, Context& ctx)
 {
     LOGC(ctx.debug_jobs)
         << "Process CountJob " << p << " @ " << this;
@@ -434,7 +738,7 @@ void BigRadixStepCE<Context, DataPtr>::count(size_t p, Context& ctx)
 
     size_t mybkt[numbkts] = { 0 };
     for (Iterator it = itB; it != itE; ++it)
-        ++mybkt[Context::key_extractor(*it, depth)];
+        ++mybkt[Digit::key(*it, depth)];
 
     memcpy(bkt + p * numbkts, mybkt, sizeof(mybkt));
 
@@ -442,19 +746,26 @@ void BigRadixStepCE<Context, DataPtr>::count(size_t p, Context& ctx)
         count_finished(ctx);
 }
 
-template <typename Context, typename DataPtr>
-void BigRadixStepCE<Context, DataPtr>::count_finished(Context& ctx)
+template <typename Context, typename DataPtr, typename Digit>
+void BigRadixStepCE<Context, DataPtr, Digit>::count_finished(Context& ctx)
 {
     LOGC(ctx.debug_jobs)
         << "Finishing CountJob " << this << " with prefixsum";
 
-    // inclusive prefix sum over bkt
+    // inclusive prefix sum over bkt, exclusive for scattering forwards
     size_t sum = 0;
     for (size_t i = 0; i < numbkts; ++i)
     {
         for (size_t p = 0; p < parts; ++p)
         {
-            bkt[p * numbkts + i] = (sum += bkt[p * numbkts + i]);
+            if (Context::enable_streaming_stores) {
+                size_t size = bkt[p * numbkts + i];
+                bkt[p * numbkts + i] = sum;
+                sum += size;
+            }
+            else {
+                bkt[p * numbkts + i] = (sum += bkt[p * numbkts + i]);
+            }
         }
     }
     assert(sum == dptr.size());
@@ -465,8 +776,8 @@ void BigRadixStepCE<Context, DataPtr>::count_finished(Context& ctx)
         ctx.threads_.enqueue([this, p, &ctx]() { distribute(p, ctx); });
 }
 
-template <typename Context, typename DataPtr>
-void BigRadixStepCE<Context, DataPtr>::distribute(size_t p, Context& ctx)
+template <typename Context, typename DataPtr, typename Digit>
+void BigRadixStepCE<Context, DataPtr, Digit>::distribute(size_t p, Context& ctx)
 {
     LOGC(ctx.debug_jobs)
         << "Process DistributeJob " << p << " @ " << this;
@@ -478,21 +789,34 @@ void BigRadixStepCE<Context, DataPtr>::distribute(size_t p, Context& ctx)
 
     Iterator sorted = dptr.shadow().begin(); // get alternative shadow pointer array
 
-    size_t mybkt[numbkts];
-    memcpy(mybkt, bkt + p * numbkts, sizeof(mybkt));
+    if (Context::enable_streaming_stores) {
+        // scatter forwards, the first part's bkt are already the bucket
+        // boundaries needed for recursion
+        streaming_scatter::StreamingScatter<value_type> scatter(numbkts);
+        for (size_t i = 0; i < numbkts; ++i)
+            scatter.set_bucket(i, &*(sorted + bkt[p * numbkts + i]));
 
-    for (Iterator it = itB; it != itE; ++it)
-        sorted[--mybkt[Context::key_extractor(*it, depth)]] = std::move(*it);
+        for (Iterator it = itB; it != itE; ++it)
+            scatter.push(Digit::key(*it, depth), std::move(*it));
+        scatter.flush();
+    }
+    else {
+        size_t mybkt[numbkts];
+        memcpy(mybkt, bkt + p * numbkts, sizeof(mybkt));
+
+        for (Iterator it = itB; it != itE; ++it)
+            sorted[--mybkt[Digit::key(*it, depth)]] = std::move(*it);
 
-    if (p == 0) // these are needed for recursion into bkts
-        memcpy(bkt, mybkt, sizeof(mybkt));
+        if (p == 0) // these are needed for recursion into bkts
+            memcpy(bkt, mybkt, sizeof(mybkt));
+    }
 
     if (--pwork == 0)
         distribute_finished(ctx);
 }
 
-template <typename Context, typename DataPtr>
-void BigRadixStepCE<Context, DataPtr>::distribute_finished(Context& ctx)
+template <typename Context, typename DataPtr, typename Digit>
+void BigRadixStepCE<Context, DataPtr, Digit>::distribute_finished(Context& ctx)
 {
     LOGC(ctx.debug_jobs)
         << "Finishing DistributeJob " << this << " with enqueuing subjobs";
@@ -510,14 +834,24 @@ void BigRadixStepCE<Context, DataPtr>::distribute_finished(Context& ctx)
             dptr.flip(bkt[i], 1).copy_back();
             ctx.donesize(1);
         }
+        else if (depth + Digit::depth_step >= ctx.max_depth) {
+            // all digits consumed, the keys of the bucket are equal
+            dptr.flip(bkt[i], bkt[i + 1] - bkt[i]).copy_back();
+            ctx.donesize(bkt[i + 1] - bkt[i]);
+        }
         else
-            ctx.enqueue(dptr.flip(bkt[i], bkt[i + 1] - bkt[i]), depth + 1);
+            ctx.enqueue(dptr.flip(bkt[i], bkt[i + 1] - bkt[i]),
+                        depth + Digit::depth_step);
     }
 
-    delete[] bkt;
-    delete this;
+    ctx.free_array(bkt);
+    ctx.destroy(this);
 }
 
+//! in-place parallel radix step, defined in msd_inplace_radixsort.hpp
+template <typename Context, typename DataPtr>
+struct InPlaceRadixStep;
+
 // ****************************************************************************
 // *** PRSContext::enqueue() and PRSContext::enqueue_small_job()
 
@@ -528,12 +862,49 @@ void PRSContext<Parameters>::enqueue_small_job(const DataPtr& dptr, size_t depth
     using Context = PRSContext<Parameters>;
 
     if (dptr.size() < (1LLU << 32))
-        new SmallsortJob<Context, uint32_t, DataPtr>(*this, dptr, depth);
+        create<SmallsortJob<Context, uint32_t, DataPtr> >(*this, dptr, depth);
     else
-        new SmallsortJob<Context, uint64_t, DataPtr>(*this, dptr, depth);
+        create<SmallsortJob<Context, uint64_t, DataPtr> >(*this, dptr, depth);
 }
 
 
+/*!
+ * A WideDigit step pays off only if each part holds enough items to amortize
+ * its 65536 counters, which at 512 KiB exceed the L1 and most L2 caches, and
+ * if the 16-bit digits of the bucket are diverse. Otherwise an 8-bit step,
+ * whose 2 KiB of counters stay in L1, leaves few buckets for the next level
+ * anyway. The diversity is estimated from the distinct digits of a sample.
+ */
+template <typename Parameters>
+template <typename DataPtr>
+bool PRSContext<Parameters>::use_wide_digit(const DataPtr& dptr, size_t depth)
+{
+    using Context = PRSContext<Parameters>;
+    const size_t wide_bkts = key_traits<uint16_t>::radix;
+
+    size_t n = dptr.size();
+    size_t parts = (n + sequential_threshold() - 1) / sequential_threshold();
+    if (depth + 2 > max_depth ||
+        n / std::max<size_t>(parts, 1) <
+        this->wide_digit_items_per_counter * wide_bkts)
+        return false;
+
+    const size_t samples = 1024;
+    uint16_t sample[samples];
+    for (size_t i = 0; i < samples; ++i) {
+        sample[i] = static_cast<uint16_t>(WideDigit<Context>::key(
+            *(dptr.active().begin() + i * (n / samples)), depth));
+    }
+    std::sort(sample, sample + samples);
+    size_t distinct = std::unique(sample, sample + samples) - sample;
+
+    LOGC(this->debug_steps)
+        << "Bucket of " << n << " items at depth " << depth << " has "
+        << distinct << " distinct 16-bit digits in " << samples << " samples";
+
+    return distinct >= this->wide_digit_min_distinct;
+}
+
 template <typename Parameters>
 template <typename DataPtr>
 void PRSContext<Parameters>::enqueue(const DataPtr& dptr, size_t depth)
@@ -542,7 +913,17 @@ void PRSContext<Parameters>::enqueue(const DataPtr& dptr, size_t depth)
 
     if (this->enable_parallel_radix_sort
      && dptr.size() > sequential_threshold()) {
-        new BigRadixStepCE<Context, DataPtr>(*this, dptr, depth);
+        if constexpr (Parameters::enable_inplace_parallel_radix_sort)
+            create<InPlaceRadixStep<Context, DataPtr> >(*this, dptr, depth);
+        else if constexpr (Parameters::enable_adaptive_digits) {
+            if (use_wide_digit(dptr, depth))
+                create<BigRadixStepCE<Context, DataPtr, WideDigit<Context> > >(
+                    *this, dptr, depth);
+            else
+                create<BigRadixStepCE<Context, DataPtr> >(*this, dptr, depth);
+        }
+        else
+            create<BigRadixStepCE<Context, DataPtr> >(*this, dptr, depth);
     }
     else {
         enqueue_small_job(dptr, depth);
@@ -554,25 +935,74 @@ void PRSContext<Parameters>::enqueue(const DataPtr& dptr, size_t depth)
 
 template <typename PRSParameters, typename Iterator>
 static inline
-void radix_sort_params(Iterator begin, Iterator end, size_t max_depth)
+void radix_sort_params(Iterator begin, Iterator end, Iterator shadow_begin,
+                       size_t max_depth,
+                       size_t num_threads = std::thread::hardware_concurrency(),
+                       size_t subsort_threshold =
+                           PRSParameters::subsort_threshold)
 {
     using Context = PRSContext<PRSParameters>;
-    using Type = typename std::iterator_traits<Iterator>::value_type;
 
-    Context ctx(std::thread::hardware_concurrency(), max_depth);
+    Context ctx(num_threads, max_depth);
+    ctx.subsort_threshold = subsort_threshold;
     ctx.totalsize = end - begin;
     ctx.rest_size = ctx.totalsize;
 
-    // allocate shadow pointer array
-    Type *shadow = new Type[ctx.totalsize];
-    Iterator shadow_begin = Iterator(shadow);
-
     ctx.enqueue(ShadowDataPtr<DummyDataSet<Iterator>>(begin, end,
                 shadow_begin, shadow_begin + ctx.totalsize), 0);
 
     ctx.threads_.loop_until_empty();
 
     assert(!ctx.enable_rest_size || ctx.rest_size == 0);
+}
+
+/*!
+ * Radix sort [begin,end) with the shadow storage, threads and job arena of a
+ * workspace, which are kept for the next sort. Items which are not trivially
+ * copyable are constructed in the shadow storage for each sort.
+ */
+template <typename PRSParameters, typename Iterator>
+static inline
+void radix_sort_params(Iterator begin, Iterator end, size_t max_depth,
+                       BasicRadixSortWorkspace<
+                           typename PRSParameters::thread_pool_type>& workspace)
+{
+    using Context = PRSContext<PRSParameters>;
+    using Type = typename std::iterator_traits<Iterator>::value_type;
+    const bool trivial = std::is_trivially_copyable<Type>::value;
+
+    Context ctx(workspace, max_depth);
+    ctx.totalsize = end - begin;
+    ctx.rest_size = ctx.totalsize;
+
+    Type* shadow = workspace.template shadow<Type>(ctx.totalsize);
+    if (!trivial)
+        std::uninitialized_default_construct_n(shadow, ctx.totalsize);
+
+    ctx.enqueue(ShadowDataPtr<DummyDataSet<Iterator> >(
+                    begin, end, Iterator(shadow),
+                    Iterator(shadow + ctx.totalsize)), 0);
+
+    ctx.threads_.loop_until_empty();
+
+    assert(!ctx.enable_rest_size || ctx.rest_size == 0);
+
+    if (!trivial)
+        std::destroy_n(shadow, ctx.totalsize);
+    workspace.arena().reset();
+}
+
+template <typename PRSParameters, typename Iterator>
+static inline
+void radix_sort_params(Iterator begin, Iterator end, size_t max_depth)
+{
+    using Type = typename std::iterator_traits<Iterator>::value_type;
+
+    // allocate shadow pointer array
+    Type *shadow = new Type[end - begin];
+
+    radix_sort_params<PRSParameters, Iterator>(
+        begin, end, Iterator(shadow), max_depth);
 
     delete[] shadow;
 }
@@ -604,6 +1034,59 @@ void radix_sort(Iterator begin, Iterator end, size_t max_depth)
             begin, end, max_depth);
 }
 
+/*!
+ * Radix sort the iterator range [begin,end) using a caller-provided shadow
+ * array of the same size, which is reused instead of allocated per call, with
+ * a thread pool of num_threads threads.
+ */
+template <typename Iterator,
+    uint8_t (*key_extractor)(
+        const typename std::iterator_traits<Iterator>::value_type&, size_t)>
+static inline
+void radix_sort(Iterator begin, Iterator end, Iterator shadow_begin,
+                size_t max_depth,
+                size_t num_threads = std::thread::hardware_concurrency())
+{
+    radix_sort_params<PRSParametersDefault<Iterator, uint8_t, key_extractor>, Iterator>(
+            begin, end, shadow_begin, max_depth, num_threads);
+}
+
+
+template <typename Iterator,
+    uint16_t (*key_extractor)(
+        const typename std::iterator_traits<Iterator>::value_type&, size_t)>
+static inline
+void radix_sort(Iterator begin, Iterator end, Iterator shadow_begin,
+                size_t max_depth,
+                size_t num_threads = std::thread::hardware_concurrency())
+{
+    radix_sort_params<PRSParametersDefault<Iterator, uint16_t, key_extractor>, Iterator>(
+            begin, end, shadow_begin, max_depth, num_threads);
+}
+
+/*!
+ * Radix sort the iterator range [begin,end) by the key returned by
+ * KeyFunction, which may be any integer up to 128 bits, signed or unsigned, a
+ * float or double, or a pair or tuple of these compared lexicographically.
+ * The order of the keys must agree with std::less on the items, which sorts
+ * small buckets. The maximum depth is the length of the key.
+ */
+template <typename Iterator, auto KeyFunction, typename KeyType = uint8_t>
+static inline
+void radix_sort_key(Iterator begin, Iterator end, Iterator shadow_begin,
+                    size_t num_threads = std::thread::hardware_concurrency())
+{
+    using Value = typename std::iterator_traits<Iterator>::value_type;
+    using Key = typename std::decay<
+        decltype(KeyFunction(std::declval<const Value&>()))>::type;
+
+    radix_sort_params<
+        PRSParametersDefault<Iterator, KeyType,
+                             radix_key_extractor<Value, KeyType, KeyFunction> >,
+        Iterator>(
+            begin, end, shadow_begin, radix_depth<KeyType, Key>(), num_threads);
+}
+
 } // namespace parallel_radixsort_detail
 } // namespace tlx
 
@@ -0,0 +1,295 @@
+/*******************************************************************************
+ * sort_parallel/extra/radix_sort_workspace.hpp
+ *
+ * Reusable workspace of the parallel MSD radix sort: uninitialized shadow
+ * storage mapped with huge pages and interleaved over the NUMA nodes, the
+ * thread pool, and per-thread arenas for jobs and bucket arrays. Sorting
+ * repeatedly with one workspace avoids allocating, zeroing and first touching
+ * the shadow array and creating threads on every call.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef PRS_RADIX_SORT_WORKSPACE_HEADER
+#define PRS_RADIX_SORT_WORKSPACE_HEADER
+
+#include <tlx/die.hpp>
+#include <tlx/thread_pool.hpp>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace tlx {
+namespace parallel_radixsort_detail {
+
+/******************************************************************************/
+//! Shadow Storage
+
+/*!
+ * Anonymous memory mapping which is grown but never shrunk. The pages are
+ * neither initialized nor touched, they are advised to be backed by
+ * transparent huge pages and interleaved round-robin over the online NUMA
+ * nodes, such that the parallel threads see the same bandwidth.
+ */
+class ShadowStorage
+{
+public:
+    ShadowStorage(bool huge_pages, bool interleave)
+        : huge_pages_(huge_pages), interleave_(interleave)
+    { }
+
+    ShadowStorage(const ShadowStorage&) = delete;
+    ShadowStorage& operator = (const ShadowStorage&) = delete;
+
+    ~ShadowStorage() {
+        if (data_)
+            munmap(data_, bytes_);
+    }
+
+    //! return at least bytes of storage, remapping if it is too small
+    void * reserve(size_t bytes) {
+        if (bytes <= bytes_)
+            return data_;
+        if (data_)
+            munmap(data_, bytes_);
+
+        void* map = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        die_unless(map != MAP_FAILED);
+        data_ = map, bytes_ = bytes;
+
+#if defined(MADV_HUGEPAGE)
+        if (huge_pages_)
+            madvise(data_, bytes_, MADV_HUGEPAGE);
+#endif
+        if (interleave_)
+            interleave_nodes(data_, bytes_);
+        return data_;
+    }
+
+    size_t bytes() const { return bytes_; }
+
+private:
+    void* data_ = nullptr;
+    size_t bytes_ = 0;
+
+    bool huge_pages_;
+    bool interleave_;
+
+    //! bind the range to MPOL_INTERLEAVE over the online nodes, if there are
+    //! several. Failures, e.g. kernels without NUMA, are ignored.
+    static void interleave_nodes(void* addr, size_t bytes) {
+#if defined(SYS_mbind)
+        std::vector<unsigned long> mask = online_nodes();
+        size_t nodes = 0;
+        for (unsigned long m : mask)
+            nodes += __builtin_popcountl(m);
+        if (nodes <= 1)
+            return;
+        const int mpol_interleave = 3;
+        syscall(SYS_mbind, addr, bytes, mpol_interleave, mask.data(),
+                mask.size() * 8 * sizeof(unsigned long) + 1, 0);
+#else
+        (void)addr, (void)bytes;
+#endif
+    }
+
+    //! node mask read from /sys/devices/system/node/online, e.g. "0-3,6"
+    static std::vector<unsigned long> online_nodes() {
+        std::vector<unsigned long> mask;
+        FILE* f = fopen("/sys/devices/system/node/online", "r");
+        if (!f)
+            return mask;
+        unsigned first, last;
+        while (fscanf(f, "%u", &first) == 1) {
+            last = first;
+            int c = fgetc(f);
+            if (c == '-') {
+                if (fscanf(f, "%u", &last) != 1)
+                    break;
+                c = fgetc(f);
+            }
+            for (unsigned n = first; n <= last; ++n) {
+                const size_t word_bits = 8 * sizeof(unsigned long);
+                if (mask.size() <= n / word_bits)
+                    mask.resize(n / word_bits + 1);
+                mask[n / word_bits] |= 1ul << (n % word_bits);
+            }
+            if (c != ',')
+                break;
+        }
+        fclose(f);
+        return mask;
+    }
+};
+
+/******************************************************************************/
+//! Job Arena
+
+/*!
+ * Bump allocator for the jobs and bucket arrays of one sort. Each of at most
+ * max_threads threads claims a slot with its own chunks on its first
+ * allocation of a sort, hence allocations do not contend. Memory is released
+ * all at once by reset(), which keeps the chunks, such that repeated sorts of
+ * similar inputs do not allocate at all.
+ */
+class JobArena
+{
+public:
+    //! allocation granularity, which avoids false sharing between jobs
+    static const size_t alignment = 64;
+
+    explicit JobArena(size_t max_threads, size_t chunk_size = 64 * 1024)
+        : slots_(max_threads), chunk_size_(chunk_size), epoch_(new_epoch())
+    { }
+
+    void * allocate(size_t bytes) {
+        bytes = (bytes + alignment - 1) / alignment * alignment;
+        Slot& s = slot();
+        while (s.current < s.chunks.size() &&
+               s.offset + bytes > s.chunks[s.current].size) {
+            ++s.current, s.offset = 0;
+        }
+        if (s.current == s.chunks.size()) {
+            size_t size = std::max(bytes, chunk_size_);
+            s.chunks.push_back(Chunk {
+                static_cast<char*>(
+                    ::operator new (size, std::align_val_t(alignment))),
+                size });
+            s.offset = 0;
+        }
+        void* p = s.chunks[s.current].data + s.offset;
+        s.offset += bytes;
+        return p;
+    }
+
+    //! release all allocations of the sort
+    void reset() {
+        for (Slot& s : slots_)
+            s.current = 0, s.offset = 0;
+        next_slot_ = 0;
+        epoch_ = new_epoch();
+    }
+
+    //! bytes of chunks held
+    size_t bytes() const {
+        size_t sum = 0;
+        for (const Slot& s : slots_) {
+            for (const Chunk& c : s.chunks)
+                sum += c.size;
+        }
+        return sum;
+    }
+
+    ~JobArena() {
+        for (Slot& s : slots_) {
+            for (Chunk& c : s.chunks)
+                ::operator delete (c.data, std::align_val_t(alignment));
+        }
+    }
+
+private:
+    struct Chunk {
+        char* data;
+        size_t size;
+    };
+
+    struct alignas(64) Slot {
+        std::vector<Chunk> chunks;
+        size_t current = 0, offset = 0;
+    };
+
+    std::vector<Slot> slots_;
+    size_t chunk_size_;
+
+    //! slots handed out during this epoch
+    std::atomic<size_t> next_slot_ { 0 };
+    //! renewed by reset(), invalidates the threads' slots. Epochs are unique
+    //! over all arenas, since a new arena may reuse the address of another.
+    size_t epoch_;
+
+    static size_t new_epoch() {
+        static std::atomic<size_t> epochs { 0 };
+        return ++epochs;
+    }
+
+    //! the calling thread's slot of this epoch
+    Slot& slot() {
+        struct Cached {
+            const JobArena* arena = nullptr;
+            size_t epoch = 0, index = 0;
+        };
+        static thread_local Cached cached;
+        if (cached.arena != this || cached.epoch != epoch_) {
+            size_t index = next_slot_++;
+            die_unless(index < slots_.size());
+            cached = Cached { this, epoch_, index };
+        }
+        return slots_[cached.index];
+    }
+};
+
+/******************************************************************************/
+//! Workspace
+
+/*!
+ * Workspace for repeated parallel radix sorts on num_threads threads of a
+ * ThreadPoolType, tlx::ThreadPool or WorkStealingPool, see
+ * radix_sort_params(). It is not safe to sort with one workspace from
+ * several threads concurrently.
+ */
+template <typename ThreadPoolType>
+class BasicRadixSortWorkspace
+{
+public:
+    explicit BasicRadixSortWorkspace(
+        size_t num_threads = std::thread::hardware_concurrency(),
+        bool huge_pages = true, bool interleave = true)
+        : shadow_(huge_pages, interleave),
+          // the pool's threads and the thread calling the sort
+          arena_(num_threads + 1),
+          threads_(num_threads)
+    { }
+
+    //! uninitialized shadow storage of n items
+    template <typename Type>
+    Type * shadow(size_t n) {
+        return static_cast<Type*>(shadow_.reserve(n * sizeof(Type)));
+    }
+
+    size_t shadow_bytes() const { return shadow_.bytes(); }
+
+    JobArena& arena() { return arena_; }
+    const JobArena& arena() const { return arena_; }
+
+    ThreadPoolType& threads() { return threads_; }
+
+    size_t num_threads() const { return threads_.size(); }
+
+private:
+    ShadowStorage shadow_;
+    JobArena arena_;
+    ThreadPoolType threads_;
+};
+
+using RadixSortWorkspace = BasicRadixSortWorkspace<ThreadPool>;
+
+} // namespace parallel_radixsort_detail
+} // namespace tlx
+
+#endif // !PRS_RADIX_SORT_WORKSPACE_HEADER
+
+/******************************************************************************/
@@ -0,0 +1,173 @@
+/*******************************************************************************
+ * sort_parallel/extra/streaming_scatter.hpp
+ *
+ * Scatter of items into many output buckets through cache line sized
+ * write-combining buffers, which are flushed with non-temporal stores. This
+ * avoids reading the destination lines for ownership before they are
+ * overwritten, which otherwise doubles the memory traffic of a radix sort's
+ * distribution step on arrays much larger than the caches.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef MBM_SORT_PARALLEL_STREAMING_SCATTER_HEADER
+#define MBM_SORT_PARALLEL_STREAMING_SCATTER_HEADER
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace streaming_scatter {
+
+static const size_t cache_line = 64;
+
+//! copy an aligned cache line to dst bypassing the caches
+static inline void stream_line(void* dst, const void* src) {
+#if defined(__AVX512F__)
+    _mm512_stream_si512(reinterpret_cast<__m512i*>(dst),
+                        _mm512_load_si512(src));
+#elif defined(__AVX__)
+    const __m256i* s = reinterpret_cast<const __m256i*>(src);
+    __m256i* d = reinterpret_cast<__m256i*>(dst);
+    _mm256_stream_si256(d + 0, _mm256_load_si256(s + 0));
+    _mm256_stream_si256(d + 1, _mm256_load_si256(s + 1));
+#elif defined(__SSE2__)
+    const __m128i* s = reinterpret_cast<const __m128i*>(src);
+    __m128i* d = reinterpret_cast<__m128i*>(dst);
+    for (size_t i = 0; i < cache_line / sizeof(__m128i); ++i)
+        _mm_stream_si128(d + i, _mm_load_si128(s + i));
+#else
+    memcpy(dst, src, cache_line);
+#endif
+}
+
+//! order the non-temporal stores before all later stores
+static inline void store_fence() {
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
+}
+
+/*!
+ * Write-combining buffers for scattering items forwards into num_buckets
+ * output ranges. Each bucket buffers the cache line of its destination which
+ * is currently written, so items may straddle lines and the outputs need no
+ * alignment. Completed lines are streamed to memory, only the first and last
+ * partial line of a range, which may be shared with neighbouring ranges, are
+ * written with regular stores by flush() and when the first line completes.
+ *
+ * Items which are not trivially copyable are moved directly.
+ */
+template <typename Item>
+class StreamingScatter {
+public:
+    static const bool supported = std::is_trivially_copyable<Item>::value;
+
+    explicit StreamingScatter(size_t num_buckets)
+        : buckets_(num_buckets) {
+        if (!supported)
+            return;
+        void* memory = nullptr;
+        if (posix_memalign(&memory, cache_line, num_buckets * cache_line) != 0)
+            throw std::bad_alloc();
+        lines_ = static_cast<char*>(memory);
+    }
+
+    StreamingScatter(const StreamingScatter&) = delete;
+    StreamingScatter& operator=(const StreamingScatter&) = delete;
+
+    ~StreamingScatter() {
+        free(lines_);
+    }
+
+    //! set the output of bucket b to start at out
+    void set_bucket(size_t b, Item* out) {
+        buckets_[b].begin = buckets_[b].pos = reinterpret_cast<char*>(out);
+    }
+
+    //! append item to bucket b
+    void push(size_t b, Item&& item) {
+        Bucket& bk = buckets_[b];
+        if constexpr (!supported) {
+            *reinterpret_cast<Item*>(bk.pos) = std::move(item);
+            bk.pos += sizeof(Item);
+        }
+        else {
+            char* line = lines_ + b * cache_line;
+            size_t offset = line_offset(bk.pos);
+            if (offset + sizeof(Item) < cache_line) {
+                memcpy(line + offset, &item, sizeof(Item));
+                bk.pos += sizeof(Item);
+                return;
+            }
+            const char* src = reinterpret_cast<const char*>(&item);
+            size_t left = sizeof(Item);
+            while (left != 0) {
+                size_t n = std::min(left, cache_line - offset);
+                memcpy(line + offset, src, n);
+                bk.pos += n, src += n, left -= n;
+                offset = 0;
+                if (line_offset(bk.pos) == 0)
+                    write_line(bk, line, bk.pos - cache_line);
+            }
+        }
+    }
+
+    //! write the partial last lines of all buckets and fence the streams
+    void flush() {
+        if constexpr (!supported)
+            return;
+        for (size_t b = 0; b < buckets_.size(); ++b) {
+            Bucket& bk = buckets_[b];
+            size_t offset = line_offset(bk.pos);
+            if (offset == 0)
+                continue;
+            char* dst = bk.pos - offset;
+            char* first = std::max(bk.begin, dst);
+            memcpy(first, lines_ + b * cache_line + (first - dst),
+                   bk.pos - first);
+        }
+        store_fence();
+    }
+
+private:
+    struct Bucket {
+        //! first byte of the output range, and the next byte to write
+        char* begin = nullptr;
+        char* pos = nullptr;
+    };
+
+    std::vector<Bucket> buckets_;
+
+    //! one cache line per bucket mirroring its current destination line
+    char* lines_ = nullptr;
+
+    static size_t line_offset(const char* p) {
+        return reinterpret_cast<uintptr_t>(p) % cache_line;
+    }
+
+    //! write the completed line at dst, partially if the range begins in it
+    void write_line(const Bucket& bk, const char* line, char* dst) {
+        if (dst >= bk.begin)
+            stream_line(dst, line);
+        else
+            memcpy(bk.begin, line + (bk.begin - dst), bk.pos - bk.begin);
+    }
+};
+
+} // namespace streaming_scatter
+
+#endif // !MBM_SORT_PARALLEL_STREAMING_SCATTER_HEADER
+
+/******************************************************************************/
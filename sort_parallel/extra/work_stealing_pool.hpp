@@ -0,0 +1,235 @@
+/*******************************************************************************
+ * sort_parallel/extra/work_stealing_pool.hpp
+ *
+ * Work-stealing drop-in for tlx::ThreadPool in the parallel MSD radix sort.
+ * Each worker owns a deque of jobs: it pushes and pops jobs at the back, idle
+ * workers steal from the front of randomly chosen victims. Jobs are small
+ * closures stored inline in the deques, hence enqueuing does not allocate
+ * once the deques have grown.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#ifndef PRS_WORK_STEALING_POOL_HEADER
+#define PRS_WORK_STEALING_POOL_HEADER
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace tlx {
+namespace parallel_radixsort_detail {
+
+/*!
+ * Thread pool with one job deque per worker and randomized stealing. It has
+ * the interface of tlx::ThreadPool used by PRSContext: enqueue(),
+ * loop_until_empty(), has_idle() and size(). Jobs enqueued by a worker go to
+ * its own deque, jobs of other threads are dealt round-robin to the workers.
+ */
+class WorkStealingPool
+{
+public:
+    //! closure of at most three words, e.g. [this, p, &ctx], stored inline
+    class Job
+    {
+    public:
+        Job() = default;
+
+        template <typename Functor>
+        Job(Functor f) : invoke_(&invoke<Functor>) {
+            static_assert(sizeof(Functor) <= sizeof(storage_),
+                          "job closure too large");
+            static_assert(std::is_trivially_copyable<Functor>::value &&
+                          std::is_trivially_destructible<Functor>::value,
+                          "job closure must be trivially copyable");
+            new (storage_) Functor(f);
+        }
+
+        void operator () () { invoke_(storage_); }
+
+    private:
+        alignas(8) unsigned char storage_[3 * sizeof(void*)];
+        void (* invoke_)(void*) = nullptr;
+
+        template <typename Functor>
+        static void invoke(void* f) { (*static_cast<Functor*>(f))(); }
+    };
+
+    explicit WorkStealingPool(
+        size_t num_threads = std::thread::hardware_concurrency())
+        : workers_(num_threads == 0 ? 1 : num_threads) {
+        threads_.reserve(workers_.size());
+        for (size_t i = 0; i < workers_.size(); ++i)
+            threads_.emplace_back([this, i]() { work(i); });
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator = (const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            terminate_ = true;
+        }
+        cv_jobs_.notify_all();
+        for (std::thread& t : threads_)
+            t.join();
+    }
+
+    //! push a job onto the calling worker's deque, or deal it to a worker
+    void enqueue(Job job) {
+        size_t i = self_index();
+        if (i == npos)
+            i = next_worker_++ % workers_.size();
+
+        ++pending_;
+        {
+            Worker& w = workers_[i];
+            std::unique_lock<std::mutex> lock(w.mutex);
+            w.jobs.push_back(job);
+        }
+        ++queued_;
+
+        if (idle_ != 0) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_jobs_.notify_one();
+        }
+    }
+
+    //! wait until all jobs, including those they enqueue, have run
+    void loop_until_empty() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_done_.wait(lock, [this]() { return pending_ == 0; });
+    }
+
+    //! whether a worker sleeps for lack of jobs
+    bool has_idle() const {
+        return idle_.load(std::memory_order_relaxed) != 0;
+    }
+
+    size_t size() const { return workers_.size(); }
+
+    //! number of jobs stolen from other workers' deques
+    size_t steals() const {
+        size_t sum = 0;
+        for (const Worker& w : workers_)
+            sum += w.steals;
+        return sum;
+    }
+
+private:
+    static const size_t npos = size_t(-1);
+
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<Job> jobs;
+        size_t steals = 0;
+    };
+
+    std::vector<Worker> workers_;
+    std::vector<std::thread> threads_;
+
+    //! jobs enqueued but not finished
+    std::atomic<size_t> pending_ { 0 };
+    //! jobs waiting in the deques
+    std::atomic<size_t> queued_ { 0 };
+    //! sleeping workers
+    std::atomic<size_t> idle_ { 0 };
+
+    std::atomic<size_t> next_worker_ { 0 };
+
+    std::mutex mutex_;
+    std::condition_variable cv_jobs_, cv_done_;
+    bool terminate_ = false;
+
+    //! worker index of the calling thread in this pool, or npos
+    size_t self_index() const { return self().pool == this ? self().index
+                                                           : npos; }
+
+    struct Self {
+        const WorkStealingPool* pool = nullptr;
+        size_t index = 0;
+    };
+
+    static Self& self() {
+        static thread_local Self s;
+        return s;
+    }
+
+    bool pop(size_t i, Job& job) {
+        Worker& w = workers_[i];
+        std::unique_lock<std::mutex> lock(w.mutex);
+        if (w.jobs.empty())
+            return false;
+        job = w.jobs.back();
+        w.jobs.pop_back();
+        --queued_;
+        return true;
+    }
+
+    bool steal(size_t i, uint64_t& rng, Job& job) {
+        size_t n = workers_.size();
+        for (size_t t = 0; t < 2 * n && queued_ != 0; ++t) {
+            // xorshift64 to pick a victim
+            rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+            size_t v = rng % n;
+            if (v == i)
+                continue;
+            Worker& w = workers_[v];
+            std::unique_lock<std::mutex> lock(w.mutex, std::try_to_lock);
+            if (!lock.owns_lock() || w.jobs.empty())
+                continue;
+            job = w.jobs.front();
+            w.jobs.pop_front();
+            --queued_;
+            ++workers_[i].steals;
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t i) {
+        self() = Self { this, i };
+        uint64_t rng = 0x9E3779B97F4A7C15ull * (i + 1);
+
+        while (true)
+        {
+            Job job;
+            if (pop(i, job) || steal(i, rng, job)) {
+                job();
+                if (--pending_ == 0) {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    cv_done_.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++idle_;
+            cv_jobs_.wait(lock, [this]() {
+                              return queued_ != 0 || terminate_;
+                          });
+            --idle_;
+            if (terminate_ && queued_ == 0)
+                return;
+        }
+    }
+};
+
+} // namespace parallel_radixsort_detail
+} // namespace tlx
+
+#endif // !PRS_WORK_STEALING_POOL_HEADER
+
+/******************************************************************************/
@@ -1,21 +1,29 @@
 /*******************************************************************************
  * mbm_sort_parallel.cpp
  *
- * Microbenchmark parallel sorting algorithms
+ * Microbenchmark parallel sorting algorithms, sweeping the number of threads
+ * placed on distinct cores and on SMT siblings. Speedup and efficiency are
+ * relative to the fastest sequential sorter on the same input. This baseline
+ * is stored next to the inputs if MBM_SORT_INPUT_CACHE is set, such that the
+ * benchmark programs measure it once.
  *
  * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
  *
  * All rights reserved. Published under the MIT License in the LICENSE file.
  ******************************************************************************/
 
-#include <microbenchmarking.hpp>
+#include <sort_benchmark.hpp>
+#include <thread_control.hpp>
 
 #include <tlx/die.hpp>
+#include <tlx/logger.hpp>
 #include <tlx/string/contains.hpp>
 
 #include <algorithm>
+#include <cstdio>
 #include <iostream>
 #include <random>
+#include <string>
 
 /******************************************************************************/
 // Settings
@@ -26,158 +34,978 @@ const size_t min_size = 1024 * 1024;
 //! maximum number of items to insert
 const size_t max_size = 512 * 1024 * 1024;
 
+//! evict CPU caches before each repetition
+const bool flush_cache = false;
+
+//! sub-sort thresholds swept by sorters with sweep_subsort_threshold
+const size_t subsort_thresholds[] = { 16, 32, 64, 128, 256 };
+
 /******************************************************************************/
 
-struct MyStruct {
-    uint32_t a, b;
+//! fastest sequential sorter of an input
+struct SequentialBaseline {
+    std::string name;
+    double ns_per_item = 0;
+};
+
+/*!
+ * Parallel sorter running on threads_ threads, set uniformly for OpenMP, TBB,
+ * ips4o and the thread pools of the sorters. Prints the speedup over the
+ * sequential baseline and the parallel efficiency, the speedup per thread.
+ */
+template <typename Item>
+class ParallelSortBenchmark : public SortBenchmark<Item> {
+public:
+    //! whether the sorter handles the item type
+    static const bool supported = true;
+
+    //! whether main() sweeps subsort_threshold_ over subsort_thresholds
+    static const bool sweep_subsort_threshold = false;
+
+    size_t threads_;
+    //! whether the threads are packed onto SMT siblings
+    bool smt_ = false;
+    SequentialBaseline baseline_;
+
+    ParallelSortBenchmark(size_t size, Distribution distribution,
+        size_t threads)
+        : SortBenchmark<Item>(size, distribution), threads_(threads) {
+    }
 
-    explicit MyStruct(uint32_t x = 0) : a(x), b(x * x) {
+    friend std::ostream& operator<<(
+        std::ostream& os, const ParallelSortBenchmark& b) {
+        double speedup = b.ns_per_item_ > 0
+                         ? b.baseline_.ns_per_item / b.ns_per_item_ : 0;
+        return os << static_cast<const SortBenchmark<Item>&>(b)
+                  << "threads=" << b.threads_ << '\t'
+                  << "smt=" << b.smt_ << '\t'
+                  << "baseline=" << b.baseline_.name << '\t'
+                  << "baseline_ns_per_item=" << b.baseline_.ns_per_item << '\t'
+                  << "speedup=" << speedup << '\t'
+                  << "efficiency=" << speedup / b.threads_ << '\t';
     }
+};
+
+/******************************************************************************/
+// Sequential Baselines
 
-    bool operator<(const MyStruct& other) const {
-        return a < other.a;
+#include "ips4o/ips4o.hpp"
+
+template <typename Item>
+class SequentialStdSort : public SortBenchmark<Item> {
+public:
+    using SortBenchmark<Item>::SortBenchmark;
+    const char* name() const final {
+        return "std::sort";
     }
+    void run() {
+        std::sort(this->vec_.begin(), this->vec_.end(), this->cmp_);
+    }
+};
 
-    friend std::ostream& operator<<(std::ostream& os, const MyStruct& s) {
-        return os << '(' << s.a << ',' << s.b << ')';
+template <typename Item>
+class SequentialIPS4o : public SortBenchmark<Item> {
+public:
+    using SortBenchmark<Item>::SortBenchmark;
+    const char* name() const final {
+        return "ips4o::(sequential_)sort";
+    }
+    void run() {
+        ips4o::sort(this->vec_.begin(), this->vec_.end(), this->cmp_);
     }
 };
 
-class SortBenchmark {
+#include "extra/lsd_radix_sort.hpp"
+
+template <typename Item>
+class SequentialLSDRadix : public SortBenchmark<Item> {
 public:
-    std::vector<MyStruct> vec_;
-    std::less<MyStruct> cmp_;
+    using typename SortBenchmark<Item>::Array;
 
-    SortBenchmark(size_t size, size_t rep) {
-        std::mt19937 rng(123456 + rep);
-        std::uniform_int_distribution<uint32_t> distr;
+    Array buffer_;
 
-        vec_.resize(size);
-        for (unsigned int i = 0; i < size; ++i)
-            vec_[i] = MyStruct(distr(rng));
+    SequentialLSDRadix(size_t size, Distribution distribution)
+        : SortBenchmark<Item>(size, distribution) {
+        this->allocate_scratch(buffer_, size);
+    }
+    const char* name() const final {
+        return "lsd_radix_sort::sort";
+    }
+    void run() {
+        lsd_radix_sort::sort(this->vec_.begin(), this->vec_.end(),
+            buffer_.begin(),
+            [](const Item& s) { return ItemTraits<Item>::key(s); });
+    }
+};
+
+//! keep the sequential sorter with the least time of reps repetitions
+template <typename Benchmark>
+void best_sequential(size_t size, Distribution distribution, size_t reps,
+    SequentialBaseline& best) {
+    Benchmark benchmark(size, distribution);
+    for (size_t rep = 0; rep < reps; ++rep) {
+        benchmark.reset(rep);
+        double ts1 = tlx::timestamp();
+        benchmark.run();
+        double ns_per_item = (tlx::timestamp() - ts1) * 1e9 / size;
+        benchmark.check();
+        if (best.ns_per_item == 0 || ns_per_item < best.ns_per_item) {
+            best.name = benchmark.name();
+            best.ns_per_item = ns_per_item;
+        }
     }
+}
+
+//! bump when the sequential sorters change, so stale baselines are not used
+static const unsigned baseline_cache_version = 1;
+
+//! construct cache file path for the baseline of an input
+static inline std::string baseline_cache_path(const char* dir, Distribution d,
+    const char* item_name, size_t n, size_t reps) {
+    char name[256];
+    snprintf(name, sizeof(name), "/baseline-v%u-v%u-%s-%s-%zu-%zu.txt",
+        baseline_cache_version, input_cache_version, distribution_name(d),
+        item_name, n, reps);
+    return std::string(dir) + name;
+}
 
-    void check() {
-        die_unless(std::is_sorted(vec_.begin(), vec_.end(), cmp_));
+//! read a cached baseline. Returns false if not available.
+static inline bool baseline_cache_load(
+    const std::string& path, SequentialBaseline& baseline) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f)
+        return false;
+    char name[256];
+    double ns_per_item;
+    bool ok = fscanf(f, "%255s %lf", name, &ns_per_item) == 2;
+    fclose(f);
+    if (!ok) {
+        LOG1 << "baseline_cache: ignoring malformed " << path;
+        return false;
     }
+    baseline.name = name;
+    baseline.ns_per_item = ns_per_item;
+    return true;
+}
 
-    virtual const char* name() const = 0;
+/*!
+ * Fastest of the sequential sorters with reps repetitions on the inputs of
+ * SortBenchmark, read from the input cache directory if enabled, else
+ * measured and stored there for the other benchmark programs.
+ */
+template <typename Item>
+SequentialBaseline sequential_baseline(
+    size_t size, Distribution distribution, size_t reps) {
+    SequentialBaseline baseline;
+
+    const char* dir = input_cache_directory();
+    std::string path;
+    if (dir) {
+        path = baseline_cache_path(
+            dir, distribution, ItemTraits<Item>::name(), size, reps);
+        if (baseline_cache_load(path, baseline))
+            return baseline;
+    }
 
-    friend std::ostream& operator<<(std::ostream& os, const SortBenchmark& b) {
-        return os << "benchmark=" << b.name() << '\t'
-                  << "size=" << b.vec_.size() << '\t';
+    best_sequential<SequentialStdSort<Item>>(
+        size, distribution, reps, baseline);
+    best_sequential<SequentialIPS4o<Item>>(
+        size, distribution, reps, baseline);
+    best_sequential<SequentialLSDRadix<Item>>(
+        size, distribution, reps, baseline);
+
+    if (dir) {
+        std::string line = baseline.name + '\t' +
+                           std::to_string(baseline.ns_per_item) + '\n';
+        input_cache_store(path, line.data(), line.size());
     }
-};
+    return baseline;
+}
 
 /******************************************************************************/
 // Parallel Sorters
 
-#include "ips4o/ips4o.hpp"
-
-class IPS4oParallelSort : public SortBenchmark {
+template <typename Item>
+class IPS4oParallelSort : public ParallelSortBenchmark<Item> {
 public:
-    IPS4oParallelSort(size_t size, size_t rep) : SortBenchmark(size, rep) {
-    }
+    using ParallelSortBenchmark<Item>::ParallelSortBenchmark;
     const char* name() const final {
         return "ips4o::parallel_sort";
     }
     void run() {
-        ips4o::parallel::sort(vec_.begin(), vec_.end(), cmp_);
+        ips4o::parallel::sort(this->vec_.begin(), this->vec_.end(), this->cmp_,
+            static_cast<int>(this->threads_));
     }
 };
 
 #include <tlx/sort/parallel_mergesort.hpp>
 
-class MCSTLParallelMergesort : public SortBenchmark {
+template <typename Item>
+class MCSTLParallelMergesort : public ParallelSortBenchmark<Item> {
 public:
-    MCSTLParallelMergesort(size_t size, size_t rep) : SortBenchmark(size, rep) {
-    }
+    using ParallelSortBenchmark<Item>::ParallelSortBenchmark;
     const char* name() const final {
         return "mcstl::parallel_sort";
     }
     void run() {
-        tlx::parallel_mergesort(vec_.begin(), vec_.end(), cmp_);
+        tlx::parallel_mergesort(this->vec_.begin(), this->vec_.end(),
+            this->cmp_, this->threads_);
     }
 };
 
+#include <tbb/global_control.h>
 #include <tbb/parallel_sort.h>
 
-class TBBParallelSort : public SortBenchmark {
+template <typename Item>
+class TBBParallelSort : public ParallelSortBenchmark<Item> {
 public:
-    TBBParallelSort(size_t size, size_t rep) : SortBenchmark(size, rep) {
+    //! limits the TBB worker threads while the benchmark lives
+    tbb::global_control control_;
+
+    TBBParallelSort(size_t size, Distribution distribution, size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads),
+          control_(tbb::global_control::max_allowed_parallelism, threads) {
     }
     const char* name() const final {
         return "tbb::parallel_sort";
     }
     void run() {
-        tbb::parallel_sort(vec_.begin(), vec_.end(), cmp_);
+        tbb::parallel_sort(this->vec_.begin(), this->vec_.end(), this->cmp_);
     }
 };
 
 #include "extra/msd_parallel_radixsort.hpp"
 
-uint8_t radix_extract_key(const MyStruct& s, size_t depth)
+//! extract byte at depth of the order-preserving key of an item
+template <typename Item>
+uint8_t radix_extract_key(const Item& s, size_t depth)
 {
-    return tlx::parallel_radixsort_detail::get_key<uint32_t, uint8_t>(s.a, depth);
+    using Key = decltype(ItemTraits<Item>::key(s));
+    return tlx::parallel_radixsort_detail::get_key<Key, uint8_t>(
+        ItemTraits<Item>::key(s), depth);
 }
 
-class ParallelMSDRadixSort : public SortBenchmark {
+template <typename Item>
+class ParallelMSDRadixSort : public ParallelSortBenchmark<Item> {
 public:
-    ParallelMSDRadixSort(size_t size, size_t rep) : SortBenchmark(size, rep) {
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+
+    Array shadow_;
+
+    ParallelMSDRadixSort(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(shadow_, size);
     }
     const char* name() const final {
         return "parallel_msd_radixsort";
     }
     void run() {
         tlx::parallel_radixsort_detail::radix_sort<
-            std::vector<MyStruct>::iterator, radix_extract_key>(
-            vec_.begin(), vec_.end(), sizeof(uint32_t));
+            Iterator, radix_extract_key<Item>>(
+            this->vec_.begin(), this->vec_.end(), shadow_.begin(),
+            sizeof(Key), this->threads_);
+    }
+};
+
+/*!
+ * Sorts with a workspace kept over the repetitions, holding the shadow
+ * storage, the thread pool and the job arena, such that only the first
+ * repetition pays for page faults and allocations.
+ */
+template <typename Item>
+class ParallelMSDRadixSortWorkspace : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+    using Parameters = tlx::parallel_radixsort_detail::PRSParametersDefault<
+        Iterator, uint8_t, radix_extract_key<Item>>;
+
+    tlx::parallel_radixsort_detail::RadixSortWorkspace workspace_;
+
+    ParallelMSDRadixSortWorkspace(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads),
+          workspace_(threads) {
+        workspace_.shadow<Item>(size);
+        this->scratch_bytes_ += workspace_.shadow_bytes();
+    }
+    const char* name() const final {
+        return "parallel_msd_radixsort+workspace";
+    }
+    void run() {
+        tlx::parallel_radixsort_detail::radix_sort_params<
+            Parameters, Iterator>(
+            this->vec_.begin(), this->vec_.end(), sizeof(Key), workspace_);
+    }
+
+    friend std::ostream& operator<<(
+        std::ostream& os, const ParallelMSDRadixSortWorkspace& b) {
+        return os << static_cast<const ParallelSortBenchmark<Item>&>(b)
+                  << "arena_bytes=" << b.workspace_.arena().bytes() << '\t';
+    }
+};
+
+//! extract 16-bit digit at depth of the order-preserving key of an item
+template <typename Item>
+uint16_t radix_extract_key16(const Item& s, size_t depth)
+{
+    using Key = decltype(ItemTraits<Item>::key(s));
+    return tlx::parallel_radixsort_detail::get_key<Key, uint16_t>(
+        ItemTraits<Item>::key(s), depth);
+}
+
+//! distributes on 16-bit digits at every level
+template <typename Item>
+class ParallelMSDRadixSort16 : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+
+    //! the 65536 counters per part thrash the TLB rather than L1I
+    static const bool count_dtlb_misses = true;
+
+    Array shadow_;
+
+    ParallelMSDRadixSort16(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(shadow_, size);
+    }
+    const char* name() const final {
+        return "parallel_msd_radixsort+16bit";
+    }
+    void run() {
+        tlx::parallel_radixsort_detail::radix_sort<
+            Iterator, radix_extract_key16<Item>>(
+            this->vec_.begin(), this->vec_.end(), shadow_.begin(),
+            sizeof(Key) / 2, this->threads_);
+    }
+};
+
+//! MSD radix sort parameters choosing 8- or 16-bit digits per large bucket
+template <typename Item>
+class PRSParametersAdaptiveDigits
+    : public tlx::parallel_radixsort_detail::PRSParametersDefault<
+          typename SortBenchmark<Item>::Iterator, uint8_t,
+          radix_extract_key<Item>> {
+public:
+    static const bool enable_adaptive_digits = true;
+};
+
+template <typename Item>
+class ParallelMSDRadixSortAdaptive : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+
+    static const bool count_dtlb_misses = true;
+
+    Array shadow_;
+
+    ParallelMSDRadixSortAdaptive(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(shadow_, size);
+    }
+    const char* name() const final {
+        return "parallel_msd_radixsort+adaptive_digits";
+    }
+    void run() {
+        tlx::parallel_radixsort_detail::radix_sort_params<
+            PRSParametersAdaptiveDigits<Item>, Iterator>(
+            this->vec_.begin(), this->vec_.end(), shadow_.begin(),
+            sizeof(Key), this->threads_);
+    }
+};
+
+#include "extra/msd_inplace_radixsort.hpp"
+
+//! distributes in place without a shadow array
+template <typename Item>
+class ParallelMSDRadixSortInPlace : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+
+    using ParallelSortBenchmark<Item>::ParallelSortBenchmark;
+
+    const char* name() const final {
+        return "parallel_msd_radixsort+inplace";
+    }
+    void run() {
+        tlx::parallel_radixsort_detail::radix_sort_inplace<
+            Iterator, radix_extract_key<Item>>(
+            this->vec_.begin(), this->vec_.end(), sizeof(Key),
+            this->threads_);
+    }
+};
+
+#include "extra/simd_small_sort.hpp"
+
+//! MSD radix sort parameters sorting buckets up to 64 items with the SIMD
+//! sorting network instead of std::sort.
+template <typename Item>
+class PRSParametersSimdSubSort
+    : public tlx::parallel_radixsort_detail::PRSParametersDefault<
+          typename SortBenchmark<Item>::Iterator, uint8_t,
+          radix_extract_key<Item>> {
+public:
+    using Iterator = typename SortBenchmark<Item>::Iterator;
+
+    static const size_t subsort_threshold = 64;
+
+    static void simd_sub_sort(Iterator begin, Iterator end, std::less<Item>) {
+        simd_small_sort::sort(begin, end,
+            [](const Item& s) { return ItemTraits<Item>::key(s); });
+    }
+
+    constexpr static auto sub_sort = simd_sub_sort;
+};
+
+/*!
+ * MSD radix sort whose buckets below the sub-sort threshold are sorted by the
+ * sequential tail of SubSort<Item>, a parameters class with a name(). main()
+ * sweeps the threshold.
+ */
+template <typename Item, template <typename> class SubSort>
+class ParallelMSDRadixSortSubSort : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+
+    static const bool sweep_subsort_threshold = true;
+
+    Array shadow_;
+    size_t subsort_threshold_ = SubSort<Item>::subsort_threshold;
+
+    ParallelMSDRadixSortSubSort(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(shadow_, size);
+    }
+    const char* name() const final {
+        return SubSort<Item>::name();
+    }
+    void run() {
+        tlx::parallel_radixsort_detail::radix_sort_params<
+            SubSort<Item>, Iterator>(
+            this->vec_.begin(), this->vec_.end(), shadow_.begin(),
+            sizeof(Key), this->threads_, subsort_threshold_);
+    }
+
+    friend std::ostream& operator<<(
+        std::ostream& os, const ParallelMSDRadixSortSubSort& b) {
+        return os << static_cast<const ParallelSortBenchmark<Item>&>(b)
+                  << "subsort_threshold=" << b.subsort_threshold_ << '\t';
+    }
+};
+
+template <typename Item>
+using PRSParametersItem = tlx::parallel_radixsort_detail::PRSParametersDefault<
+    typename SortBenchmark<Item>::Iterator, uint8_t, radix_extract_key<Item>>;
+
+//! std::sort on whole items, the default
+template <typename Item>
+struct StdSubSort : public PRSParametersItem<Item> {
+    static const char* name() {
+        return "parallel_msd_radixsort+std_sort_tail";
+    }
+};
+
+//! sequential ips4o on whole items
+template <typename Item>
+struct IPS4oSubSort : public PRSParametersItem<Item> {
+    using Iterator = typename SortBenchmark<Item>::Iterator;
+
+    static const char* name() {
+        return "parallel_msd_radixsort+ips4o_tail";
+    }
+    static void ips4o_sub_sort(
+        Iterator begin, Iterator end, std::less<Item> cmp) {
+        ips4o::sort(begin, end, cmp);
+    }
+
+    constexpr static auto sub_sort = ips4o_sub_sort;
+};
+
+//! insertion sort on the digits from the bucket's depth on
+template <typename Item>
+struct InsertionSubSort : public PRSParametersItem<Item> {
+    static const bool sub_sort_from_depth = true;
+
+    static const char* name() {
+        return "parallel_msd_radixsort+insertion_tail";
+    }
+};
+
+//! SIMD bitonic sorting network
+template <typename Item>
+struct SimdSubSort : public PRSParametersSimdSubSort<Item> {
+    static const char* name() {
+        return "parallel_msd_radixsort+simd_tail";
+    }
+};
+
+//! in-place American flag radix sort down to std::sort on whole items
+template <typename Item>
+struct AmericanFlagSubSort : public PRSParametersItem<Item> {
+    static const bool inplace_sequential_sort = true;
+
+    static const char* name() {
+        return "parallel_msd_radixsort+american_flag_tail";
+    }
+};
+
+template <typename Item>
+using ParallelMSDRadixSortStdTail =
+    ParallelMSDRadixSortSubSort<Item, StdSubSort>;
+template <typename Item>
+using ParallelMSDRadixSortIPS4oTail =
+    ParallelMSDRadixSortSubSort<Item, IPS4oSubSort>;
+template <typename Item>
+using ParallelMSDRadixSortInsertionTail =
+    ParallelMSDRadixSortSubSort<Item, InsertionSubSort>;
+template <typename Item>
+using ParallelMSDRadixSortSimdTail =
+    ParallelMSDRadixSortSubSort<Item, SimdSubSort>;
+template <typename Item>
+using ParallelMSDRadixSortAmericanFlagTail =
+    ParallelMSDRadixSortSubSort<Item, AmericanFlagSubSort>;
+
+//! MSD radix sort parameters distributing with non-temporal stores
+template <typename Item>
+class PRSParametersStreaming
+    : public tlx::parallel_radixsort_detail::PRSParametersDefault<
+          typename SortBenchmark<Item>::Iterator, uint8_t,
+          radix_extract_key<Item>> {
+public:
+    static const bool enable_streaming_stores = true;
+};
+
+template <typename Item>
+class ParallelMSDRadixSortStreaming : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+
+    Array shadow_;
+
+    ParallelMSDRadixSortStreaming(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(shadow_, size);
+    }
+    const char* name() const final {
+        return "parallel_msd_radixsort+streaming_stores";
+    }
+    void run() {
+        tlx::parallel_radixsort_detail::radix_sort_params<
+            PRSParametersStreaming<Item>, Iterator>(
+            this->vec_.begin(), this->vec_.end(), shadow_.begin(),
+            sizeof(Key), this->threads_);
+    }
+};
+
+#include "extra/work_stealing_pool.hpp"
+
+//! MSD radix sort parameters running the jobs on per-worker deques with
+//! randomized stealing instead of the shared queue of tlx::ThreadPool
+template <typename Item>
+class PRSParametersWorkStealing
+    : public tlx::parallel_radixsort_detail::PRSParametersDefault<
+          typename SortBenchmark<Item>::Iterator, uint8_t,
+          radix_extract_key<Item>> {
+public:
+    typedef tlx::parallel_radixsort_detail::WorkStealingPool thread_pool_type;
+};
+
+/*!
+ * Sorts with a workspace of a WorkStealingPool kept over the repetitions,
+ * like ParallelMSDRadixSortWorkspace, such that the jobs come from the
+ * per-thread slots of the job arena. Prints the jobs stolen per run.
+ */
+template <typename Item>
+class ParallelMSDRadixSortWorkStealing : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Iterator;
+    using Key = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+    using Workspace = tlx::parallel_radixsort_detail::BasicRadixSortWorkspace<
+        tlx::parallel_radixsort_detail::WorkStealingPool>;
+
+    Workspace workspace_;
+    size_t steals_ = 0;
+
+    ParallelMSDRadixSortWorkStealing(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads),
+          workspace_(threads) {
+        workspace_.shadow<Item>(size);
+        this->scratch_bytes_ += workspace_.shadow_bytes();
+    }
+    const char* name() const final {
+        return "parallel_msd_radixsort+work_stealing";
+    }
+    void run() {
+        size_t steals = workspace_.threads().steals();
+        tlx::parallel_radixsort_detail::radix_sort_params<
+            PRSParametersWorkStealing<Item>, Iterator>(
+            this->vec_.begin(), this->vec_.end(), sizeof(Key), workspace_);
+        steals_ = workspace_.threads().steals() - steals;
+    }
+
+    friend std::ostream& operator<<(
+        std::ostream& os, const ParallelMSDRadixSortWorkStealing& b) {
+        return os << static_cast<const ParallelSortBenchmark<Item>&>(b)
+                  << "arena_bytes=" << b.workspace_.arena().bytes() << '\t'
+                  << "steals=" << b.steals_ << '\t';
+    }
+};
+
+/*!
+ * MSD radix sort by the key of KeyMap<Item>, whose radix representation and
+ * depth are derived from its type by tlx::parallel_radixsort_detail::
+ * radix_key. The keys are order-preserving maps of the item keys.
+ */
+template <typename Item, template <typename> class KeyMap>
+class ParallelMSDRadixSortKey : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+
+    static const bool supported = KeyMap<Item>::supported;
+
+    Array shadow_;
+
+    ParallelMSDRadixSortKey(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(shadow_, size);
+    }
+    const char* name() const final {
+        return KeyMap<Item>::name();
+    }
+    void run() {
+        tlx::parallel_radixsort_detail::radix_sort_key<
+            Iterator, KeyMap<Item>::key>(
+            this->vec_.begin(), this->vec_.end(), shadow_.begin(),
+            this->threads_);
+    }
+};
+
+template <typename Item>
+using ItemKey = decltype(ItemTraits<Item>::key(std::declval<Item>()));
+
+//! the key widened to 64 bits, e.g. timestamps
+template <typename Item>
+struct U64KeyMap {
+    static const bool supported = true;
+    static const char* name() {
+        return "parallel_msd_radixsort+u64_key";
+    }
+    static uint64_t key(const Item& s) {
+        return ItemTraits<Item>::key(s);
+    }
+};
+
+//! the key shifted into the signed 64-bit range
+template <typename Item>
+struct I64KeyMap {
+    static const bool supported = true;
+    static const char* name() {
+        return "parallel_msd_radixsort+i64_key";
+    }
+    static int64_t key(const Item& s) {
+        return static_cast<int64_t>(
+            static_cast<uint64_t>(ItemTraits<Item>::key(s)) ^
+            (uint64_t(1) << 63));
+    }
+};
+
+//! the key shifted into the signed 128-bit range
+template <typename Item>
+struct I128KeyMap {
+    static const bool supported = true;
+    static const char* name() {
+        return "parallel_msd_radixsort+i128_key";
+    }
+    using Int128 = tlx::parallel_radixsort_detail::int128;
+
+    static Int128 key(const Item& s) {
+        return static_cast<Int128>(ItemTraits<Item>::key(s)) -
+               (static_cast<Int128>(1) << 100);
     }
 };
 
+template <typename Item>
+struct IsFloatKey : std::false_type { };
+
+template <typename Float, typename UInt>
+struct IsFloatKey<FloatKey<Float, UInt>> : std::true_type { };
+
+//! the float or double of f32 and f64 items, 32-bit keys as exact doubles
+//! around zero
+template <typename Item>
+struct FloatKeyMap {
+    static const bool supported =
+        IsFloatKey<Item>::value || sizeof(ItemKey<Item>) <= 4;
+    static const char* name() {
+        return "parallel_msd_radixsort+float_key";
+    }
+    static auto key(const Item& s) {
+        if constexpr (IsFloatKey<Item>::value)
+            return s.key;
+        else
+            return static_cast<double>(ItemTraits<Item>::key(s)) - 2147483648.0;
+    }
+};
+
+//! the key split into a (tenant, id) pair of its halves
+template <typename Item>
+struct PairKeyMap {
+    using Half = typename std::conditional<
+        sizeof(ItemKey<Item>) == 8, uint32_t, uint16_t>::type;
+
+    static const bool supported = true;
+    static const char* name() {
+        return "parallel_msd_radixsort+pair_key";
+    }
+    static std::pair<Half, Half> key(const Item& s) {
+        ItemKey<Item> k = ItemTraits<Item>::key(s);
+        return std::make_pair(static_cast<Half>(k >> (8 * sizeof(Half))),
+                              static_cast<Half>(k));
+    }
+};
+
+template <typename Item>
+using ParallelMSDRadixSortU64Key = ParallelMSDRadixSortKey<Item, U64KeyMap>;
+template <typename Item>
+using ParallelMSDRadixSortI64Key = ParallelMSDRadixSortKey<Item, I64KeyMap>;
+template <typename Item>
+using ParallelMSDRadixSortI128Key = ParallelMSDRadixSortKey<Item, I128KeyMap>;
+template <typename Item>
+using ParallelMSDRadixSortFloatKey =
+    ParallelMSDRadixSortKey<Item, FloatKeyMap>;
+template <typename Item>
+using ParallelMSDRadixSortPairKey = ParallelMSDRadixSortKey<Item, PairKeyMap>;
+
 #include "extra/lsd_radix_sort_prefix.hpp"
 
-class ParallelLSDRadixSort : public SortBenchmark {
+//! runs on the OpenMP thread count set by apply_thread_config()
+template <typename Item>
+class ParallelLSDRadixSort : public ParallelSortBenchmark<Item> {
 public:
-    ParallelLSDRadixSort(size_t size, size_t rep) : SortBenchmark(size, rep) {
+    using typename SortBenchmark<Item>::Array;
+
+    static const bool stable = true;
+
+    Array data_cache_;
+    tlx::SimpleVector<uint8_t, tlx::SimpleVectorMode::NoInitNoDestroy>
+        key_cache_;
+
+    ParallelLSDRadixSort(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(data_cache_, size);
+        this->allocate_scratch(key_cache_, size);
     }
     const char* name() const final {
         return "parallel_lsd_radixsort";
     }
     void run() {
-        auto getter = [](const MyStruct& s) { return s.a; };
-        rdx::radix_sort_prefix_par(vec_.begin(), vec_.end(), getter);
+        auto getter = [](const Item& s) { return ItemTraits<Item>::key(s); };
+        rdx::radix_sort_prefix_par(this->vec_.begin(), this->vec_.end(),
+            getter, data_cache_.data(), key_cache_.data());
     }
 };
 
-/******************************************************************************/
+//! without the key cache, each pass reads the keys from the items
+template <typename Item>
+class ParallelLSDRadixSortNoCache : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
 
-template <typename Benchmark>
-void test_size(size_t size, size_t rep) {
+    static const bool stable = true;
 
-    Microbenchmark mbm;
-    mbm.enable_hw_cpu_cycles();
-    mbm.enable_hw_instructions();
-    mbm.enable_hw_ref_cpu_cycles();
+    Array data_cache_;
 
-    mbm.enable_hw_cache1(
-        PerfCache::L1I, PerfCacheOp::Read, PerfCacheOpResult::Miss);
-    mbm.enable_hw_cache2(
-        PerfCache::L1D, PerfCacheOp::Read, PerfCacheOpResult::Miss);
-    mbm.enable_hw_cache3(
-        PerfCache::LL, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+    ParallelLSDRadixSortNoCache(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(data_cache_, size);
+    }
+    const char* name() const final {
+        return "parallel_lsd_radixsort_no_cache";
+    }
+    void run() {
+        auto getter = [](const Item& s) { return ItemTraits<Item>::key(s); };
+        rdx::radix_sort_prefix_par_no_cache(this->vec_.begin(),
+            this->vec_.end(), getter, data_cache_.data());
+    }
+};
 
-    mbm.run_check_print(Benchmark(size, rep));
-}
+//! scatters through per-thread write back buffers, which are allocated once
+//! for the OpenMP thread count set by apply_thread_config()
+template <typename Item>
+class ParallelLSDRadixSortWriteBack : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
 
-int main() {
-    for (size_t size = min_size; size <= max_size; size = 2 * size) {
-        size_t f = (8 * 1024 * 1024) / size;
-        for (size_t rep = 0; rep < std::max<size_t>(10, 100 * f); ++rep) {
-            // MBM_ALGORITHM is defined from cmake to select algorithm
-            test_size<MBM_ALGORITHM>(size, rep);
-        }
+    static const bool stable = true;
+
+    Array data_cache_;
+    rdx::WriteBackBuffers<Item> write_back_;
+
+    ParallelLSDRadixSortWriteBack(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads),
+          write_back_(omp_get_max_threads()) {
+        this->allocate_scratch(data_cache_, size);
+        this->scratch_bytes_ += write_back_.bytes();
+    }
+    const char* name() const final {
+        return "parallel_lsd_radixsort_write_back";
+    }
+    void run() {
+        auto getter = [](const Item& s) { return ItemTraits<Item>::key(s); };
+        rdx::radix_sort_prefix_par_no_cache_write_back_buffer(
+            this->vec_.begin(), this->vec_.end(), getter,
+            data_cache_.data(), write_back_);
     }
+};
+
+//! redistributes with non-temporal stores through write-combining buffers
+template <typename Item>
+class ParallelLSDRadixSortStreaming : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+
+    static const bool stable = true;
+
+    Array data_cache_;
+    tlx::SimpleVector<uint8_t, tlx::SimpleVectorMode::NoInitNoDestroy>
+        key_cache_;
+
+    ParallelLSDRadixSortStreaming(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(data_cache_, size);
+        this->allocate_scratch(key_cache_, size);
+    }
+    const char* name() const final {
+        return "parallel_lsd_radixsort+streaming_stores";
+    }
+    void run() {
+        auto getter = [](const Item& s) { return ItemTraits<Item>::key(s); };
+        rdx::radix_sort_prefix_par</* streaming_stores */ true>(
+            this->vec_.begin(), this->vec_.end(), getter,
+            data_cache_.data(), key_cache_.data());
+    }
+};
+
+/*!
+ * Counts all digits of DigitBits bits in one sweep and skips digits in which
+ * all keys agree, printing the passes executed and the bytes of items moved.
+ */
+template <typename Item, size_t DigitBits>
+class ParallelLSDRadixSortMultiDigit : public ParallelSortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+
+    static const bool stable = true;
+
+    Array data_cache_;
+    rdx::MultiDigitStats stats_;
+
+    ParallelLSDRadixSortMultiDigit(size_t size, Distribution distribution,
+        size_t threads)
+        : ParallelSortBenchmark<Item>(size, distribution, threads) {
+        this->allocate_scratch(data_cache_, size);
+    }
+    const char* name() const final {
+        return "parallel_lsd_radixsort_multi_digit";
+    }
+    void run() {
+        auto getter = [](const Item& s) { return ItemTraits<Item>::key(s); };
+        stats_ = rdx::radix_sort_multi_digit_par<DigitBits>(
+            this->vec_.begin(), this->vec_.end(), getter, data_cache_.data());
+    }
+
+    friend std::ostream& operator<<(
+        std::ostream& os, const ParallelLSDRadixSortMultiDigit& b) {
+        return os << static_cast<const ParallelSortBenchmark<Item>&>(b)
+                  << "digit_bits=" << DigitBits << '\t'
+                  << "digits=" << b.stats_.digits << '\t'
+                  << "passes=" << b.stats_.passes << '\t'
+                  << "bytes_moved=" << b.stats_.bytes_moved << '\t'
+                  << "bytes_moved_per_item="
+                  << static_cast<double>(b.stats_.bytes_moved) / b.vec_.size()
+                  << '\t';
+    }
+};
+
+template <typename Item>
+using ParallelLSDRadixSortMultiDigit8 =
+    ParallelLSDRadixSortMultiDigit<Item, 8>;
+
+template <typename Item>
+using ParallelLSDRadixSortMultiDigit11 =
+    ParallelLSDRadixSortMultiDigit<Item, 11>;
+
+/******************************************************************************/
+
+int main(int argc, char* argv[]) {
+    // distributions and item types can be selected on the command line
+    SortSelection selection(argc, argv);
+
+    // read before any pinning restricts the CPUs
+    CpuTopology topology;
+    std::vector<ThreadConfig> sweep = thread_sweep(topology);
+
+    selection.for_each_item([&](auto tag) {
+        using Item = typename decltype(tag)::type;
+        // MBM_ALGORITHM is defined from cmake to select algorithm
+        using Benchmark = MBM_ALGORITHM<Item>;
+
+        if constexpr (Benchmark::supported) {
+            // limit the bytes of the items and their storage to those of
+            // max_size MyStruct items
+            size_t max_items = max_size * sizeof(MyStruct) / item_bytes<Item>();
+
+            for (Distribution distribution : selection.distributions_) {
+                for (size_t size = min_size; size <= max_items; size *= 2) {
+                    size_t f = (8 * 1024 * 1024) / size;
+                    size_t reps = std::max<size_t>(10, 100 * f);
+
+                    apply_thread_config(topology, ThreadConfig { 1, false });
+                    SequentialBaseline baseline = sequential_baseline<Item>(
+                        size, distribution, std::min<size_t>(reps, 3));
+
+                    for (const ThreadConfig& config : sweep) {
+                        apply_thread_config(topology, config);
+                        Benchmark benchmark(size, distribution, config.threads);
+                        benchmark.smt_ = config.smt;
+                        benchmark.baseline_ = baseline;
+                        if constexpr (Benchmark::sweep_subsort_threshold) {
+                            for (size_t t : subsort_thresholds) {
+                                benchmark.subsort_threshold_ = t;
+                                test_benchmark(benchmark, reps, flush_cache);
+                            }
+                        }
+                        else {
+                            test_benchmark(benchmark, reps, flush_cache);
+                        }
+                    }
+                }
+            }
+        }
+    });
 
     return 0;
 }
@@ -0,0 +1,433 @@
+/*******************************************************************************
+ * mbm_sort_strings.cpp
+ *
+ * Microbenchmark string sorting algorithms
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#include <microbenchmarking.hpp>
+
+#include <input_distributions.hpp>
+
+#include <tlx/container/simple_vector.hpp>
+#include <tlx/die.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/******************************************************************************/
+// Settings
+
+//! starting number of strings to sort
+const size_t min_size = 64 * 1024;
+
+//! maximum number of strings to sort
+const size_t max_size = 8 * 1024 * 1024;
+
+/******************************************************************************/
+// String Corpora
+
+enum class Corpus {
+    //! random printable ASCII strings of length [10,30]
+    Random,
+    //! URL-like strings: Zipf distributed hosts and path words
+    Url,
+    //! a shared 64 character prefix followed by 12 random digits
+    CommonPrefix,
+    //! reads of length 100 from a random ACGT reference sequence
+    Dna,
+};
+
+static const Corpus all_corpora[] = {
+    Corpus::Random, Corpus::Url, Corpus::CommonPrefix, Corpus::Dna,
+};
+
+//! return RESULT name of a corpus
+static inline const char* corpus_name(Corpus c) {
+    switch (c) {
+    case Corpus::Random:
+        return "random";
+    case Corpus::Url:
+        return "url";
+    case Corpus::CommonPrefix:
+        return "common_prefix";
+    case Corpus::Dna:
+        return "dna";
+    }
+    return "unknown";
+}
+
+//! parse a corpus name, returns false if unknown
+static inline bool parse_corpus(const char* name, Corpus* c) {
+    for (Corpus x : all_corpora) {
+        if (strcmp(name, corpus_name(x)) == 0) {
+            *c = x;
+            return true;
+        }
+    }
+    return false;
+}
+
+//! appends characters to dst, or only counts them if dst is nullptr
+struct StringWriter {
+    unsigned char* dst;
+    size_t size = 0;
+
+    explicit StringWriter(unsigned char* d) : dst(d) {
+    }
+
+    void put(char c) {
+        if (dst)
+            dst[size] = static_cast<unsigned char>(c);
+        ++size;
+    }
+    void put(const char* s) {
+        while (*s)
+            put(*s++);
+    }
+};
+
+/*!
+ * Generates the strings of a corpus. Each string i is derived from its own
+ * SplitMix64 stream, such that the length can be determined in a first pass
+ * and the characters written in a second, both in parallel.
+ */
+class CorpusGenerator {
+public:
+    CorpusGenerator(Corpus corpus, size_t n, uint64_t seed)
+        : corpus_(corpus), n_(n), seed_(seed),
+          host_zipf_(num_hosts, 1.0), word_zipf_(num_words, 1.0) {
+    }
+
+    //! write string i without terminator and return its length
+    size_t write(size_t i, unsigned char* dst) const {
+        StringWriter w(dst);
+        SplitMix64 rng(seed_, i);
+
+        switch (corpus_) {
+        case Corpus::Random: {
+            size_t length = 10 + rng() % 21;
+            for (size_t j = 0; j < length; ++j)
+                w.put(static_cast<char>(33 + rng() % 94));
+            break;
+        }
+        case Corpus::Url: {
+            static const char* tlds[] = { ".com", ".org", ".net", ".de", ".io" };
+            w.put(rng() % 4 == 0 ? "http://" : "https://");
+            w.put("www.");
+            size_t host = static_cast<size_t>(host_zipf_(rng));
+            put_word(w, host);
+            w.put(tlds[host % 5]);
+            size_t segments = 1 + rng() % 4;
+            for (size_t s = 0; s < segments; ++s) {
+                w.put('/');
+                put_word(w, num_hosts + static_cast<size_t>(word_zipf_(rng)));
+            }
+            if (rng() % 2 == 0) {
+                w.put("?id=");
+                w.put(std::to_string(rng() % 1000000).c_str());
+            }
+            break;
+        }
+        case Corpus::CommonPrefix: {
+            SplitMix64 prefix(seed_, n_);
+            for (size_t j = 0; j < 64; ++j)
+                w.put(static_cast<char>('a' + prefix() % 26));
+            for (size_t j = 0; j < 12; ++j)
+                w.put(static_cast<char>('0' + rng() % 10));
+            break;
+        }
+        case Corpus::Dna: {
+            size_t offset = rng() % (4 * n_);
+            for (size_t j = offset; j < offset + 100; ++j)
+                w.put(dna_base(j));
+            break;
+        }
+        }
+        return w.size;
+    }
+
+private:
+    Corpus corpus_;
+    size_t n_;
+    uint64_t seed_;
+
+    //! number of distinct hosts and path words of URLs
+    static const size_t num_hosts = 4096, num_words = 65536;
+    const ZipfDistribution host_zipf_, word_zipf_;
+
+    //! deterministic lower case word of length [3,10] for a vocabulary id
+    void put_word(StringWriter& w, size_t id) const {
+        SplitMix64 rng(seed_ + 1, id);
+        size_t length = 3 + rng() % 8;
+        for (size_t j = 0; j < length; ++j)
+            w.put(static_cast<char>('a' + rng() % 26));
+    }
+
+    //! base at position j of the random reference sequence, 32 bases per draw
+    char dna_base(size_t j) const {
+        uint64_t bits = SplitMix64(seed_ + 2, j / 32)();
+        return "ACGT"[(bits >> (2 * (j % 32))) & 3];
+    }
+};
+
+/******************************************************************************/
+
+//! hash of a zero terminated string, mixing its characters in words of eight
+static inline uint64_t string_hash(const unsigned char* s) {
+    uint64_t h = 0;
+    for (size_t j = 8; j == 8; s += j) {
+        uint64_t word = 0;
+        for (j = 0; j < 8 && s[j] != 0; ++j)
+            word |= static_cast<uint64_t>(s[j]) << (8 * j);
+        h = SplitMix64::mix(h ^ word);
+    }
+    return h;
+}
+
+//! order-independent fingerprint of the multiset of strings get(i), i < n
+template <typename GetString>
+uint64_t fingerprint(GetString get, size_t n) {
+    uint64_t sum = 0;
+#pragma omp parallel for reduction(+ : sum) schedule(static)
+    for (size_t i = 0; i < n; ++i)
+        sum += string_hash(get(i));
+    return sum;
+}
+
+/******************************************************************************/
+
+class StringSortBenchmark {
+public:
+    template <typename Type>
+    using Array = tlx::SimpleVector<Type, tlx::SimpleVectorMode::NoInitNoDestroy>;
+
+    //! characters of all strings, zero terminated, in input order
+    Array<unsigned char> chars_;
+    //! pointers into chars_, which are sorted
+    Array<unsigned char*> strings_;
+    //! string start positions in chars_
+    Array<size_t> offsets_;
+    Corpus corpus_;
+
+    //! multiset fingerprint of the input, computed by reset()
+    uint64_t fingerprint_ = 0;
+    //! characters of the input, without terminators
+    size_t bytes_ = 0;
+    //! distinguishing prefix size of the input, computed by check()
+    size_t dprefix_ = 0;
+    //! time of the last run(), set before printing
+    double time_ = 0;
+
+    StringSortBenchmark(size_t size, Corpus corpus)
+        : strings_(size), offsets_(size), corpus_(corpus) {
+    }
+
+    //! regenerate the corpus of repetition rep: string lengths first, then
+    //! the characters at their prefix sum positions.
+    void reset(size_t rep) {
+        const size_t n = strings_.size();
+        CorpusGenerator gen(corpus_, n, 123456 + rep);
+
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i)
+            offsets_[i] = gen.write(i, nullptr);
+
+        size_t total = 0;
+        for (size_t i = 0; i < n; ++i) {
+            size_t length = offsets_[i];
+            offsets_[i] = total;
+            total += length + 1;
+        }
+        bytes_ = total - n;
+
+        if (chars_.size() < total)
+            chars_ = Array<unsigned char>(total);
+
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i) {
+            unsigned char* s = chars_.data() + offsets_[i];
+            s[gen.write(i, s)] = 0;
+            strings_[i] = s;
+        }
+
+        fingerprint_ = fingerprint([&](size_t i) { return strings_[i]; }, n);
+    }
+
+    //! check order and multiset of sorted strings get(i) and sum the
+    //! distinguishing prefix: per string, one more than the longest common
+    //! prefix with either neighbor, capped at the string length including
+    //! terminator.
+    template <typename GetString>
+    void check_dprefix(GetString get) {
+        const size_t n = strings_.size();
+        die_unless(fingerprint(get, n) == fingerprint_);
+        size_t lcp_prev = 0;
+        dprefix_ = 0;
+        for (size_t i = 0; i < n; ++i) {
+            const unsigned char* s = get(i);
+            size_t lcp_next = 0;
+            if (i + 1 < n) {
+                const unsigned char* t = get(i + 1);
+                while (s[lcp_next] != 0 && s[lcp_next] == t[lcp_next])
+                    ++lcp_next;
+                die_unless(s[lcp_next] <= t[lcp_next]);
+            }
+            size_t length = strlen(reinterpret_cast<const char*>(s));
+            dprefix_ += std::min(std::max(lcp_prev, lcp_next) + 1, length + 1);
+            lcp_prev = lcp_next;
+        }
+    }
+
+    void check() {
+        check_dprefix([&](size_t i) { return strings_[i]; });
+    }
+
+    virtual const char* name() const = 0;
+
+    friend std::ostream& operator<<(
+        std::ostream& os, const StringSortBenchmark& b) {
+        return os << "benchmark=" << b.name() << '\t'
+                  << "corpus=" << corpus_name(b.corpus_) << '\t'
+                  << "size=" << b.strings_.size() << '\t'
+                  << "bytes=" << b.bytes_ << '\t'
+                  << "dprefix=" << b.dprefix_ << '\t'
+                  << "dprefix_ratio="
+                  << static_cast<double>(b.dprefix_) / b.bytes_ << '\t'
+                  << "ns_per_byte=" << b.time_ * 1e9 / b.bytes_ << '\t'
+                  << "ns_per_dbyte=" << b.time_ * 1e9 / b.dprefix_ << '\t';
+    }
+};
+
+/******************************************************************************/
+// String Sorters
+
+class StdSortStrings : public StringSortBenchmark {
+public:
+    //! copies of the strings, constructed before the run
+    std::vector<std::string> vec_;
+
+    StdSortStrings(size_t size, Corpus corpus)
+        : StringSortBenchmark(size, corpus) {
+    }
+    const char* name() const final {
+        return "std::sort(std::string)";
+    }
+    void reset(size_t rep) {
+        StringSortBenchmark::reset(rep);
+        vec_.clear();
+        for (const unsigned char* s : strings_)
+            vec_.emplace_back(reinterpret_cast<const char*>(s));
+    }
+    void run() {
+        std::sort(vec_.begin(), vec_.end());
+    }
+    void check() {
+        check_dprefix([&](size_t i) {
+            return reinterpret_cast<const unsigned char*>(vec_[i].c_str());
+        });
+    }
+};
+
+#include <tlx/sort/strings/multikey_quicksort.hpp>
+
+class TlxMultikeyQuicksort : public StringSortBenchmark {
+public:
+    using StringSortBenchmark::StringSortBenchmark;
+    const char* name() const final {
+        return "tlx::multikey_quicksort";
+    }
+    void run() {
+        tlx::sort_strings_detail::multikey_quicksort(
+            tlx::sort_strings_detail::UCharStringSet(
+                strings_.begin(), strings_.end()),
+            /* depth */ 0, /* memory */ 0);
+    }
+};
+
+#include <tlx/sort/strings/radix_sort.hpp>
+
+class TlxRadixSort : public StringSortBenchmark {
+public:
+    using StringSortBenchmark::StringSortBenchmark;
+    const char* name() const final {
+        return "tlx::radixsort_CE3";
+    }
+    void run() {
+        tlx::sort_strings_detail::radixsort_CE3(
+            tlx::sort_strings_detail::UCharStringSet(
+                strings_.begin(), strings_.end()),
+            /* depth */ 0, /* memory */ 0);
+    }
+};
+
+#include <tlx/sort/strings_parallel.hpp>
+
+class TlxParallelSampleSort : public StringSortBenchmark {
+public:
+    using StringSortBenchmark::StringSortBenchmark;
+    const char* name() const final {
+        return "tlx::sort_strings_parallel";
+    }
+    void run() {
+        tlx::sort_strings_parallel(strings_.data(), strings_.size());
+    }
+};
+
+/******************************************************************************/
+
+template <typename Benchmark>
+void test_size(size_t size, size_t reps, Corpus corpus) {
+
+    Microbenchmark mbm;
+    mbm.enable_hw_cpu_cycles();
+    mbm.enable_hw_instructions();
+    mbm.enable_hw_cache_misses();
+
+    mbm.enable_hw_cache1(
+        PerfCache::L1D, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+    mbm.enable_hw_cache2(
+        PerfCache::LL, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+    mbm.enable_hw_cache3(
+        PerfCache::DTLB, PerfCacheOp::Read, PerfCacheOpResult::Miss);
+
+    Benchmark benchmark(size, corpus);
+
+    for (size_t rep = 0; rep < reps; ++rep) {
+        benchmark.reset(rep);
+        mbm.run(benchmark);
+        benchmark.check();
+        benchmark.time_ = mbm.time();
+        mbm.print(benchmark);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<Corpus> corpora;
+    for (int i = 1; i < argc; ++i) {
+        Corpus c;
+        if (!parse_corpus(argv[i], &c))
+            die("Unknown corpus " << argv[i]);
+        corpora.push_back(c);
+    }
+    if (corpora.empty())
+        corpora.assign(std::begin(all_corpora), std::end(all_corpora));
+
+    for (Corpus corpus : corpora) {
+        for (size_t size = min_size; size <= max_size; size *= 2) {
+            size_t f = max_size / size;
+            size_t reps = std::max<size_t>(5, f);
+            test_size<MBM_ALGORITHM>(size, reps, corpus);
+        }
+    }
+
+    return 0;
+}
+
+/******************************************************************************/
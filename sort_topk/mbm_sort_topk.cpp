@@ -0,0 +1,285 @@
+/*******************************************************************************
+ * mbm_sort_topk.cpp
+ *
+ * Microbenchmark partial sorting: selecting the k smallest items in ascending
+ * order, on the same inputs as the full sort benchmarks.
+ *
+ * Copyright (C) 2020 Timo Bingmann <tb@panthema.net>
+ *
+ * All rights reserved. Published under the MIT License in the LICENSE file.
+ ******************************************************************************/
+
+#include <sort_benchmark.hpp>
+
+#include <tlx/die.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+/******************************************************************************/
+// Settings
+
+//! starting number of items to select from
+const size_t min_size = 1024 * 1024;
+
+//! maximum number of items to select from
+const size_t max_size = 16 * 1024 * 1024;
+
+//! numbers of smallest items selected
+const size_t k_list[] = { 1, 10, 100, 1000, 10000, 100000 };
+
+//! evict CPU caches before each repetition
+const bool flush_cache = false;
+
+/******************************************************************************/
+
+/*!
+ * Top-k selection on the input of SortBenchmark. run() stores the k smallest
+ * items in ascending order at result_, either a prefix of vec_ or out_.
+ */
+template <typename Item>
+class TopKBenchmark : public SortBenchmark<Item> {
+public:
+    using typename SortBenchmark<Item>::Array;
+    using typename SortBenchmark<Item>::Iterator;
+
+    //! number of smallest items to select
+    size_t k_;
+
+    //! output array of k items for the sorters not working in-place
+    Array out_;
+
+    //! begin of the k selected items, set by run()
+    Iterator result_;
+
+    //! copy of vec_ to compute the expected result in check()
+    Array expected_;
+
+    TopKBenchmark(size_t size, Distribution distribution, size_t k)
+        : SortBenchmark<Item>(size, distribution), k_(k) {
+        this->allocate_scratch(out_, k);
+    }
+
+    //! check that vec_ is unchanged or a permutation of the input and
+    //! compare the result to a partial_sort of it.
+    void check() {
+        const size_t n = this->vec_.size();
+        die_unless(parallel_is_sorted(result_, result_ + k_, this->cmp_));
+        die_unless(fingerprint(this->vec_.data(), n) == this->fingerprint_);
+        if (expected_.size() != n)
+            expected_.resize(n);
+#pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < n; ++i)
+            expected_[i] = this->vec_[i];
+        std::partial_sort(expected_.begin(), expected_.begin() + k_,
+            expected_.end(), this->cmp_);
+        for (size_t i = 0; i < k_; ++i) {
+            die_unless(!this->cmp_(result_[i], expected_[i]) &&
+                       !this->cmp_(expected_[i], result_[i]));
+        }
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const TopKBenchmark& b) {
+        return os << static_cast<const SortBenchmark<Item>&>(b)
+                  << "k=" << b.k_ << '\t';
+    }
+};
+
+/******************************************************************************/
+// Top-k Selectors
+
+template <typename Item>
+class StdPartialSort : public TopKBenchmark<Item> {
+public:
+    StdPartialSort(size_t size, Distribution distribution, size_t k)
+        : TopKBenchmark<Item>(size, distribution, k) {
+    }
+    const char* name() const final {
+        return "std::partial_sort";
+    }
+    void run() {
+        std::partial_sort(this->vec_.begin(), this->vec_.begin() + this->k_,
+            this->vec_.end(), this->cmp_);
+        this->result_ = this->vec_.begin();
+    }
+};
+
+template <typename Item>
+class StdNthElement : public TopKBenchmark<Item> {
+public:
+    StdNthElement(size_t size, Distribution distribution, size_t k)
+        : TopKBenchmark<Item>(size, distribution, k) {
+    }
+    const char* name() const final {
+        return "std::nth_element+std::sort";
+    }
+    void run() {
+        auto kth = this->vec_.begin() + (this->k_ - 1);
+        std::nth_element(
+            this->vec_.begin(), kth, this->vec_.end(), this->cmp_);
+        std::sort(this->vec_.begin(), kth, this->cmp_);
+        this->result_ = this->vec_.begin();
+    }
+};
+
+#include <extra/top_k.hpp>
+
+template <typename Item>
+class HeapTopK : public TopKBenchmark<Item> {
+public:
+    HeapTopK(size_t size, Distribution distribution, size_t k)
+        : TopKBenchmark<Item>(size, distribution, k) {
+    }
+    const char* name() const final {
+        return "top_k::heap_select";
+    }
+    void run() {
+        top_k::heap_select(this->vec_.begin(), this->vec_.end(), this->k_,
+            this->out_.begin(), this->cmp_);
+        this->result_ = this->out_.begin();
+    }
+};
+
+template <typename Item>
+class TournamentTopK : public TopKBenchmark<Item> {
+public:
+    //! tournament tree nodes
+    tlx::SimpleVector<size_t, tlx::SimpleVectorMode::NoInitNoDestroy> tree_;
+
+    TournamentTopK(size_t size, Distribution distribution, size_t k)
+        : TopKBenchmark<Item>(size, distribution, k) {
+        this->allocate_scratch(tree_, 2 * k);
+    }
+    const char* name() const final {
+        return "top_k::tournament_select";
+    }
+    void run() {
+        top_k::tournament_select(this->vec_.begin(), this->vec_.end(),
+            this->k_, this->out_.begin(), tree_.data(), this->cmp_);
+        this->result_ = this->out_.begin();
+    }
+};
+
+template <typename Item>
+class FilterTopK : public TopKBenchmark<Item> {
+public:
+    using typename TopKBenchmark<Item>::Array;
+
+    //! candidates passing the filter
+    Array buffer_;
+
+    FilterTopK(size_t size, Distribution distribution, size_t k)
+        : TopKBenchmark<Item>(size, distribution, k) {
+        this->allocate_scratch(buffer_, top_k::filter_buffer_size(k));
+    }
+    const char* name() const final {
+        return "top_k::filter_select";
+    }
+    void run() {
+        top_k::filter_select(this->vec_.begin(), this->vec_.end(), this->k_,
+            buffer_.begin(),
+            [](const Item& s) { return ItemTraits<Item>::key(s); },
+            this->cmp_);
+        this->result_ = buffer_.begin();
+    }
+};
+
+/*!
+ * Each thread selects the k smallest items of its contiguous range with a
+ * heap, then the k smallest of the per-thread candidates are selected
+ * sequentially.
+ */
+template <typename Item>
+class ParallelHeapTopK : public TopKBenchmark<Item> {
+public:
+    using typename TopKBenchmark<Item>::Array;
+
+    //! k candidates of each thread
+    Array candidates_;
+    //! number of candidates of each thread
+    std::vector<size_t> counts_;
+
+    ParallelHeapTopK(size_t size, Distribution distribution, size_t k)
+        : TopKBenchmark<Item>(size, distribution, k) {
+#if defined(_OPENMP)
+        size_t threads = omp_get_max_threads();
+#else
+        size_t threads = 1;
+#endif
+        this->allocate_scratch(candidates_, threads * k);
+        counts_.resize(threads);
+    }
+    const char* name() const final {
+        return "top_k::heap_select(parallel)";
+    }
+    void run() {
+        const size_t k = this->k_;
+        std::fill(counts_.begin(), counts_.end(), 0);
+        parallel_ranges(this->vec_.size(), [&](size_t begin, size_t end) {
+#if defined(_OPENMP)
+            size_t p = omp_get_thread_num();
+#else
+            size_t p = 0;
+#endif
+            size_t n = std::min(k, end - begin);
+            if (n == 0)
+                return;
+            top_k::heap_select(this->vec_.begin() + begin,
+                this->vec_.begin() + end, n, candidates_.begin() + p * k,
+                this->cmp_);
+            counts_[p] = n;
+        });
+        // compact the candidates of threads with less than k items
+        size_t total = 0;
+        for (size_t p = 0; p < counts_.size(); ++p) {
+            std::copy(candidates_.begin() + p * k,
+                candidates_.begin() + p * k + counts_[p],
+                candidates_.begin() + total);
+            total += counts_[p];
+        }
+        std::partial_sort(candidates_.begin(), candidates_.begin() + k,
+            candidates_.begin() + total, this->cmp_);
+        std::copy(candidates_.begin(), candidates_.begin() + k,
+            this->out_.begin());
+        this->result_ = this->out_.begin();
+    }
+};
+
+/******************************************************************************/
+
+int main(int argc, char* argv[]) {
+    // distributions and item types can be selected on the command line
+    SortSelection selection(argc, argv);
+
+    selection.for_each_item([&](auto tag) {
+        using Item = typename decltype(tag)::type;
+        // MBM_ALGORITHM is defined from cmake to select algorithm
+        using Benchmark = MBM_ALGORITHM<Item>;
+
+        // limit the bytes of the items and their storage to those of
+        // max_size MyStruct items
+        size_t max_items = max_size * sizeof(MyStruct) / item_bytes<Item>();
+
+        for (Distribution distribution : selection.distributions_) {
+            for (size_t size = min_size; size <= max_items; size *= 4) {
+                size_t f = (16 * 1024 * 1024) / size;
+                size_t reps = std::max<size_t>(5, 5 * f);
+                for (size_t k : k_list) {
+                    if (k > size)
+                        break;
+                    Benchmark benchmark(size, distribution, k);
+                    test_benchmark(benchmark, reps, flush_cache);
+                }
+            }
+        }
+    });
+
+    return 0;
+}
+
+/******************************************************************************/